@@ -0,0 +1,205 @@
+﻿#include "binary_io.h"
+
+#include <array>
+
+namespace Chat {
+
+void BinaryWriter::U8(uint8_t value) { out_.push_back(static_cast<char>(value)); }
+
+void BinaryWriter::U32(uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    out_.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+void BinaryWriter::U64(uint64_t value) {
+  for (int i = 0; i < 8; ++i) {
+    out_.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+void BinaryWriter::Str(std::string_view value) {
+  U32(static_cast<uint32_t>(value.size()));
+  out_.append(value);
+}
+
+bool BinaryReader::Take(std::size_t size) {
+  if (!ok_ || data_.size() - pos_ < size) {
+    ok_ = false;
+    return false;
+  }
+  return true;
+}
+
+uint8_t BinaryReader::U8() {
+  if (!Take(1)) {
+    return 0;
+  }
+  return static_cast<uint8_t>(data_[pos_++]);
+}
+
+uint32_t BinaryReader::U32() {
+  if (!Take(4)) {
+    return 0;
+  }
+  uint32_t value = 0;
+  for (int i = 0; i < 4; ++i) {
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(data_[pos_++]))
+             << (8 * i);
+  }
+  return value;
+}
+
+uint64_t BinaryReader::U64() {
+  if (!Take(8)) {
+    return 0;
+  }
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) {
+    value |= static_cast<uint64_t>(static_cast<uint8_t>(data_[pos_++]))
+             << (8 * i);
+  }
+  return value;
+}
+
+std::string BinaryReader::Str() {
+  const uint32_t size = U32();
+  if (!Take(size)) {
+    return {};
+  }
+  std::string value(data_.substr(pos_, size));
+  pos_ += size;
+  return value;
+}
+
+uint32_t Crc32(std::string_view data) {
+  static const auto table = [] {
+    std::array<uint32_t, 256> t{};
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+
+  uint32_t crc = 0xFFFFFFFFu;
+  for (char ch : data) {
+    crc = table[(crc ^ static_cast<uint8_t>(ch)) & 0xFF] ^ (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFFu;
+}
+
+std::string Sha256(std::string_view data) {
+  static constexpr std::array<uint32_t, 64> k = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+      0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+      0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+      0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+      0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+      0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+      0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+      0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+      0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+  const auto rotr = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+
+  // Padding: 0x80, zeros up to 56 mod 64, then the bit length big-endian
+  std::string message(data);
+  message.push_back(static_cast<char>(0x80));
+  while (message.size() % 64 != 56) {
+    message.push_back('\0');
+  }
+  const uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+  for (int i = 7; i >= 0; --i) {
+    message.push_back(static_cast<char>((bits >> (8 * i)) & 0xFF));
+  }
+
+  std::array<uint32_t, 8> h = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                               0xa54ff53a, 0x510e527f, 0x9b05688c,
+                               0x1f83d9ab, 0x5be0cd19};
+  for (std::size_t chunk = 0; chunk < message.size(); chunk += 64) {
+    std::array<uint32_t, 64> w{};
+    for (int i = 0; i < 16; ++i) {
+      for (int b = 0; b < 4; ++b) {
+        w[i] = (w[i] << 8) |
+               static_cast<uint8_t>(message[chunk + i * 4 + b]);
+      }
+    }
+    for (int i = 16; i < 64; ++i) {
+      const uint32_t s0 =
+          rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      const uint32_t s1 =
+          rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    auto v = h;
+    for (int i = 0; i < 64; ++i) {
+      const uint32_t s1 = rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25);
+      const uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+      const uint32_t t1 = v[7] + s1 + ch + k[i] + w[i];
+      const uint32_t s0 = rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22);
+      const uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+      const uint32_t t2 = s0 + maj;
+      v = {t1 + t2, v[0], v[1], v[2], v[3] + t1, v[4], v[5], v[6]};
+    }
+    for (int i = 0; i < 8; ++i) {
+      h[i] += v[i];
+    }
+  }
+
+  std::string digest;
+  digest.reserve(32);
+  for (uint32_t word : h) {
+    for (int i = 3; i >= 0; --i) {
+      digest.push_back(static_cast<char>((word >> (8 * i)) & 0xFF));
+    }
+  }
+  return digest;
+}
+
+void AppendRecord(std::string &out, std::string_view payload) {
+  BinaryWriter writer(out);
+  writer.U32(static_cast<uint32_t>(payload.size()));
+  writer.U32(Crc32(payload));
+  out.append(payload);
+}
+
+bool NextRecord(std::string_view data, std::size_t &offset,
+                std::string_view &payload) {
+  if (offset > data.size() || data.size() - offset < kRecordHeaderSize) {
+    return false;
+  }
+
+  BinaryReader header(data.substr(offset, kRecordHeaderSize));
+  const uint32_t size = header.U32();
+  const uint32_t crc = header.U32();
+  if (data.size() - offset - kRecordHeaderSize < size) {
+    return false;
+  }
+
+  const auto body = data.substr(offset + kRecordHeaderSize, size);
+  if (Crc32(body) != crc) {
+    return false;
+  }
+
+  payload = body;
+  offset += kRecordHeaderSize + size;
+  return true;
+}
+
+bool TornRecord(std::string_view data, std::size_t offset) {
+  if (offset > data.size() || data.size() - offset < kRecordHeaderSize) {
+    return true;
+  }
+
+  BinaryReader header(data.substr(offset, kRecordHeaderSize));
+  const uint32_t size = header.U32();
+  return data.size() - offset - kRecordHeaderSize <= size;
+}
+
+} // namespace Chat
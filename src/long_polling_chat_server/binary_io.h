@@ -0,0 +1,63 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace Chat {
+
+// Little-endian encoding shared by the message log and the chat journal
+class BinaryWriter {
+public:
+  explicit BinaryWriter(std::string &out) : out_(out) {}
+
+  void U8(uint8_t value);
+  void U32(uint32_t value);
+  void U64(uint64_t value);
+  void I64(int64_t value) { U64(static_cast<uint64_t>(value)); }
+  void Str(std::string_view value);
+
+private:
+  std::string &out_;
+};
+
+// Bounds-checked reads; after the first failure Ok() returns false
+class BinaryReader {
+public:
+  explicit BinaryReader(std::string_view data) : data_(data) {}
+
+  uint8_t U8();
+  uint32_t U32();
+  uint64_t U64();
+  int64_t I64() { return static_cast<int64_t>(U64()); }
+  std::string Str();
+
+  bool Ok() const { return ok_; }
+
+private:
+  bool Take(std::size_t size);
+
+  std::string_view data_;
+  std::size_t pos_ = 0;
+  bool ok_ = true;
+};
+
+uint32_t Crc32(std::string_view data);
+// SHA-256 digest of data, 32 raw bytes
+std::string Sha256(std::string_view data);
+
+// A framed record is the payload size, the payload CRC-32, then the payload
+constexpr std::size_t kRecordHeaderSize = 8;
+
+void AppendRecord(std::string &out, std::string_view payload);
+// Reads the record at offset and moves offset past it. Returns false on a
+// truncated or corrupted record, which is where a torn write ends the data
+bool NextRecord(std::string_view data, std::size_t &offset,
+                std::string_view &payload);
+// Whether a record NextRecord rejected at offset can be a torn write: its
+// header or payload is cut short, or its payload runs exactly to the end of
+// data. Any other bad record is corruption of data that was written whole
+bool TornRecord(std::string_view data, std::size_t offset);
+
+} // namespace Chat
@@ -0,0 +1,85 @@
+﻿#include "chat_journal.h"
+#include "binary_io.h"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace Chat {
+
+ChatJournal::ChatJournal(const std::filesystem::path &path) {
+  if (path.has_parent_path()) {
+    std::filesystem::create_directories(path.parent_path());
+  }
+  file_ = std::fopen(path.string().c_str(), "ab");
+  if (file_ == nullptr) {
+    throw std::runtime_error("Failed to open chat journal: " + path.string());
+  }
+}
+
+ChatJournal::~ChatJournal() { std::fclose(file_); }
+
+void ChatJournal::Append(const JournalRecord &record) {
+  std::string payload;
+  BinaryWriter writer(payload);
+  writer.U8(static_cast<uint8_t>(record.type));
+  writer.I64(record.id);
+  writer.I64(record.participant_id);
+  writer.Str(record.name);
+  writer.Str(record.api_key);
+
+  std::string data;
+  AppendRecord(data, payload);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (std::fwrite(data.data(), 1, data.size(), file_) != data.size() ||
+      std::fflush(file_) != 0) {
+    throw std::runtime_error("Failed to append to chat journal");
+  }
+}
+
+void ChatJournal::Replay(
+    const std::filesystem::path &path,
+    const std::function<void(const JournalRecord &)> &apply) {
+  std::string data;
+  {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      return;
+    }
+    data.assign(std::istreambuf_iterator<char>(in),
+                std::istreambuf_iterator<char>());
+  }
+
+  std::size_t offset = 0;
+  std::string_view payload;
+  while (NextRecord(data, offset, payload)) {
+    BinaryReader reader(payload);
+    JournalRecord record;
+    record.type = static_cast<JournalRecord::Type>(reader.U8());
+    record.id = reader.I64();
+    record.participant_id = reader.I64();
+    record.name = reader.Str();
+    record.api_key = reader.Str();
+    if (!reader.Ok()) {
+      throw std::runtime_error("Malformed chat journal record: " +
+                               path.string());
+    }
+    apply(record);
+  }
+
+  // Only the last record can be torn by a crash; cutting the file anywhere
+  // else would silently drop participants and rooms whose ids are reused
+  if (offset < data.size()) {
+    if (!TornRecord(data, offset)) {
+      throw std::runtime_error("Chat journal " + path.string() +
+                               " is corrupted at offset " +
+                               std::to_string(offset));
+    }
+    std::filesystem::resize_file(path, offset);
+  }
+}
+
+} // namespace Chat
@@ -0,0 +1,54 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+
+namespace Chat {
+
+// One change to participants, rooms or membership. Messages are kept in
+// the rooms' MessageLogs instead
+struct JournalRecord {
+  enum class Type : uint8_t {
+    Participant = 1, // id, name, api_key in plain text (older journals)
+    Room = 2,        // id, name, participant_id is the creator
+    Join = 3,        // id is the room, participant_id
+    Leave = 4,       // id is the room, participant_id
+    ParticipantKeyHash = 5 // id, name, api_key holds Sha256 of the key
+  };
+
+  Type type{Type::Participant};
+  int64_t id{};
+  int64_t participant_id{};
+  std::string name;
+  std::string api_key;
+};
+
+// Append-only file that lets ChatManager rebuild everything but messages
+// after a restart. Appends are flushed to the OS, like MessageLog's. Only
+// hashes of API keys are written, so the file does not grant access
+class ChatJournal {
+public:
+  explicit ChatJournal(const std::filesystem::path &path);
+  ~ChatJournal();
+
+  ChatJournal(const ChatJournal &) = delete;
+  ChatJournal &operator=(const ChatJournal &) = delete;
+
+  void Append(const JournalRecord &record);
+
+  // Applies the records of path in order. A torn record at the end is cut
+  // off so that appends continue after the last complete one; a bad record
+  // anywhere else throws
+  static void Replay(const std::filesystem::path &path,
+                     const std::function<void(const JournalRecord &)> &apply);
+
+private:
+  std::mutex mutex_;
+  std::FILE *file_{nullptr};
+};
+
+} // namespace Chat
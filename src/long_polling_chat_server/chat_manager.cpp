@@ -1,29 +1,80 @@
 ﻿#include "chat_manager.h"
+#include "binary_io.h"
+#include "chat_journal.h"
+#include "message_log.h"
 
 #include <algorithm>
 #include <chrono>
+#include <stdexcept>
 
 namespace Chat {
 
+namespace {
+
+// Distinguishes managers in the per-thread API key cache
+std::atomic<uint64_t> next_instance_id{1};
+
+constexpr const char *kJournalFile = "chat.journal";
+
+std::filesystem::path RoomLogDir(const StorageOptions &storage,
+                                 int64_t room_id) {
+  return storage.dir / "rooms" / std::to_string(room_id);
+}
+
+} // namespace
+
+ChatManager::ChatManager()
+    : instance_id_(next_instance_id.fetch_add(1, std::memory_order_relaxed)),
+      api_keys_(std::make_shared<const ApiKeyIndex>()),
+      room_chunks_(new std::atomic<RoomChunk *>[kMaxRoomChunks]) {
+  for (std::size_t i = 0; i < kMaxRoomChunks; ++i) {
+    room_chunks_[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+ChatManager::ChatManager(const StorageOptions &storage) : ChatManager() {
+  storage_ = storage;
+  storage_->memory_tail = std::max<std::size_t>(storage_->memory_tail, 1);
+  std::filesystem::create_directories(storage_->dir);
+
+  Restore();
+  journal_ = std::make_unique<ChatJournal>(storage_->dir / kJournalFile);
+}
+
+ChatManager::~ChatManager() = default;
+
 Participant ChatManager::CreateParticipant(const std::string &name) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::lock_guard<std::mutex> lock(participants_mutex_);
 
   Participant participant;
   participant.id = next_participant_id_++;
   participant.name = name;
   participant.api_key = GenerateApiKey();
+  const std::string api_key_hash = Sha256(participant.api_key);
+
+  JournalRecord record;
+  record.type = JournalRecord::Type::ParticipantKeyHash;
+  record.id = participant.id;
+  record.name = participant.name;
+  record.api_key = api_key_hash;
+  Journal(record);
+
+  participants_[participant.id] = Participant{participant.id, name, {}};
 
-  participants_[participant.id] = participant;
-  api_key_index_[participant.api_key] = participant.id;
+  auto api_keys = std::make_shared<ApiKeyIndex>(
+      *api_keys_.load(std::memory_order_relaxed));
+  api_keys->emplace(api_key_hash, participant.id);
+  api_keys_.store(std::move(api_keys), std::memory_order_release);
+  api_keys_version_.fetch_add(1, std::memory_order_release);
 
   return participant;
 }
 
 bool ChatManager::Authenticate(const std::string &api_key,
                                int64_t &participant_id) const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  const auto it = api_key_index_.find(api_key);
-  if (it == api_key_index_.end()) {
+  const auto &api_keys = CurrentApiKeys();
+  const auto it = api_keys.find(Sha256(api_key));
+  if (it == api_keys.end()) {
     return false;
   }
 
@@ -32,32 +83,64 @@ bool ChatManager::Authenticate(const std::string &api_key,
 }
 
 ChatRoom ChatManager::CreateRoom(const std::string &name, int64_t creator_id) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::lock_guard<std::mutex> lock(rooms_mutex_);
 
-  ChatRoom room;
-  room.id = next_room_id_++;
-  room.name = name;
-  room.participants.insert(creator_id);
+  if (static_cast<std::size_t>(next_room_id_) >=
+      kMaxRoomChunks * kRoomChunkSize) {
+    throw std::length_error("Too many chat rooms");
+  }
 
-  rooms_[room.id] = room;
+  auto state = std::make_unique<RoomState>();
+  state->room.id = next_room_id_;
+  state->room.name = name;
+  state->room.participants.insert(creator_id);
+
+  // Journaled before the room is visible, so its membership changes always
+  // follow it in the journal. The log is opened first: once the record is
+  // written nothing may throw before the id is taken, or a retry would
+  // journal a second room under the same id
+  if (storage_) {
+    const auto dir = RoomLogDir(*storage_, state->room.id);
+    state->log = std::make_unique<MessageLog>(dir, state->room.id,
+                                              storage_->segment_bytes);
+    // History left under an unused id belongs to a room the journal lost;
+    // handing it to new members would leak it
+    if (state->log->LastId() != 0) {
+      throw std::runtime_error("Message log of a new room is not empty: " +
+                               dir.string());
+    }
+    JournalRecord record;
+    record.type = JournalRecord::Type::Room;
+    record.id = state->room.id;
+    record.participant_id = creator_id;
+    record.name = name;
+    Journal(record);
+  }
+
+  ++next_room_id_;
+  ChatRoom room = state->room;
+  InsertRoom(std::move(state));
   return room;
 }
 
 ChatManager::RoomMutationResult
 ChatManager::AddParticipantToRoom(int64_t room_id, int64_t requester_id,
                                   int64_t participant_id) {
-  std::lock_guard<std::mutex> lock(mutex_);
-
-  const auto room_it = rooms_.find(room_id);
-  if (room_it == rooms_.end()) {
+  RoomState *state = FindRoom(room_id);
+  if (state == nullptr) {
     return RoomMutationResult::RoomNotFound;
   }
 
-  if (participants_.find(participant_id) == participants_.end()) {
-    return RoomMutationResult::ParticipantNotFound;
+  // Participants are never removed, so the check stays valid after unlocking
+  {
+    std::lock_guard<std::mutex> lock(participants_mutex_);
+    if (participants_.find(participant_id) == participants_.end()) {
+      return RoomMutationResult::ParticipantNotFound;
+    }
   }
 
-  auto &room = room_it->second;
+  std::lock_guard<std::mutex> lock(state->mutex);
+  auto &room = state->room;
   if (!room.participants.contains(requester_id)) {
     return RoomMutationResult::Forbidden;
   }
@@ -66,6 +149,12 @@ ChatManager::AddParticipantToRoom(int64_t room_id, int64_t requester_id,
     return RoomMutationResult::AlreadyMember;
   }
 
+  JournalRecord record;
+  record.type = JournalRecord::Type::Join;
+  record.id = room_id;
+  record.participant_id = participant_id;
+  Journal(record);
+
   room.participants.insert(participant_id);
   return RoomMutationResult::Ok;
 }
@@ -73,14 +162,13 @@ ChatManager::AddParticipantToRoom(int64_t room_id, int64_t requester_id,
 ChatManager::RoomMutationResult
 ChatManager::RemoveParticipantFromRoom(int64_t room_id, int64_t requester_id,
                                        int64_t participant_id) {
-  std::lock_guard<std::mutex> lock(mutex_);
-
-  const auto room_it = rooms_.find(room_id);
-  if (room_it == rooms_.end()) {
+  RoomState *state = FindRoom(room_id);
+  if (state == nullptr) {
     return RoomMutationResult::RoomNotFound;
   }
 
-  auto &room = room_it->second;
+  std::lock_guard<std::mutex> lock(state->mutex);
+  auto &room = state->room;
   if (!room.participants.contains(requester_id)) {
     return RoomMutationResult::Forbidden;
   }
@@ -89,6 +177,12 @@ ChatManager::RemoveParticipantFromRoom(int64_t room_id, int64_t requester_id,
     return RoomMutationResult::NotMember;
   }
 
+  JournalRecord record;
+  record.type = JournalRecord::Type::Leave;
+  record.id = room_id;
+  record.participant_id = participant_id;
+  Journal(record);
+
   room.participants.erase(participant_id);
   return RoomMutationResult::Ok;
 }
@@ -98,14 +192,13 @@ ChatManager::CreateMessage(int64_t room_id, int64_t author_id,
                          const std::string &type, const std::string &text,
                          const std::string &image_url,
                          Message &created_message) {
-  std::lock_guard<std::mutex> lock(mutex_);
-
-  const auto room_it = rooms_.find(room_id);
-  if (room_it == rooms_.end()) {
+  RoomState *state = FindRoom(room_id);
+  if (state == nullptr) {
     return MessagePostResult::RoomNotFound;
   }
 
-  auto &room = room_it->second;
+  std::unique_lock<std::mutex> lock(state->mutex);
+  auto &room = state->room;
   if (!room.participants.contains(author_id)) {
     return MessagePostResult::NotInRoom;
   }
@@ -125,56 +218,93 @@ ChatManager::CreateMessage(int64_t room_id, int64_t author_id,
   }
 
   Message message;
-  message.id = next_message_id_++;
+  // Taken under the room lock, so ids still grow along each room's history
+  message.id = next_message_id_.fetch_add(1, std::memory_order_relaxed);
   message.room_id = room_id;
   message.author_id = author_id;
   message.type = type;
   message.text = text;
   message.image_url = image_url;
-  message.created_at_ms = NowUnixMs();
+  // Keep created_at_ms non-decreasing even if the system clock steps back
+  message.created_at_ms =
+      std::max(NowUnixMs(), state->last_created_at_ms);
+
+  // On disk first: a failed write leaves the room unchanged
+  if (state->log) {
+    state->log->Append(message);
+  }
 
   room.messages.push_back(message);
+  state->last_message_id = message.id;
+  state->last_created_at_ms = message.created_at_ms;
+  if (storage_ && room.messages.size() > storage_->memory_tail) {
+    state->evicted_id = room.messages.front().id;
+    state->evicted_created_at_ms = room.messages.front().created_at_ms;
+    room.messages.pop_front();
+  }
   created_message = message;
 
-  cv_.notify_all();
+  auto &waiters = state->waiters;
+  // Every pending async poll found nothing when it was registered, so this
+  // message alone completes the ones it matches
+  std::vector<PollHandler> ready;
+  for (auto it = waiters.async_polls.begin();
+       it != waiters.async_polls.end();) {
+    const auto &poll = it->second;
+    if (message.id > poll.since_id &&
+        (poll.from_ts_ms <= 0 || message.created_at_ms >= poll.from_ts_ms)) {
+      ready.push_back(std::move(it->second.handler));
+      it = waiters.async_polls.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  const bool notify = waiters.waiting > 0;
+  lock.unlock();
+  // Rooms are never removed, so waiters outlives the lock
+  if (notify) {
+    waiters.cv.notify_all();
+  }
+  for (auto &handler : ready) {
+    handler(ReadResult::Ok, {message});
+  }
   return MessagePostResult::Ok;
 }
 
 ChatManager::ReadResult ChatManager::GetMessages(
     int64_t room_id, int64_t requester_id, int64_t since_id, int64_t from_ts_ms,
-    int64_t to_ts_ms, std::vector<Message> &out_messages) const {
-  std::lock_guard<std::mutex> lock(mutex_);
-
-  const auto room_it = rooms_.find(room_id);
-  if (room_it == rooms_.end()) {
+    int64_t to_ts_ms, int64_t limit, std::vector<Message> &out_messages) const {
+  const RoomState *state = FindRoom(room_id);
+  if (state == nullptr) {
     return ReadResult::RoomNotFound;
   }
 
-  const auto &room = room_it->second;
+  std::lock_guard<std::mutex> lock(state->mutex);
+  const auto &room = state->room;
   if (!room.participants.contains(requester_id)) {
     return ReadResult::NotInRoom;
   }
 
-  out_messages = FilterMessages(room, since_id, from_ts_ms, to_ts_ms);
+  out_messages = ReadMessages(*state, since_id, from_ts_ms, to_ts_ms, limit);
   return ReadResult::Ok;
 }
 
 ChatManager::ReadResult ChatManager::PollMessages(
     int64_t room_id, int64_t requester_id, int64_t since_id, int64_t from_ts_ms,
-    int timeout_seconds, std::vector<Message> &out_messages) {
-  std::unique_lock<std::mutex> lock(mutex_);
-
-  const auto room_it = rooms_.find(room_id);
-  if (room_it == rooms_.end()) {
+    int timeout_seconds, int64_t limit, std::vector<Message> &out_messages) {
+  RoomState *state = FindRoom(room_id);
+  if (state == nullptr) {
     return ReadResult::RoomNotFound;
   }
 
-  auto &room = room_it->second;
+  std::unique_lock<std::mutex> lock(state->mutex);
+  const auto &room = state->room;
   if (!room.participants.contains(requester_id)) {
     return ReadResult::NotInRoom;
   }
 
-  out_messages = FilterMessages(room, since_id, from_ts_ms, -1);
+  out_messages = ReadMessages(*state, since_id, from_ts_ms, -1, limit);
   if (!out_messages.empty()) {
     return ReadResult::Ok;
   }
@@ -183,15 +313,206 @@ ChatManager::ReadResult ChatManager::PollMessages(
     timeout_seconds = 1;
   }
 
-  cv_.wait_for(lock, std::chrono::seconds(timeout_seconds), [&] {
-    const auto available = FilterMessages(room, since_id, from_ts_ms, -1);
-    return !available.empty();
-  });
+  // Messages up to seen_id have already been filtered; only newer ones can
+  // match after a wakeup
+  int64_t seen_id = std::max(since_id, LastMessageId(*state));
+  auto &waiters = state->waiters;
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(timeout_seconds);
+
+  // Leaves the waiter count right even when reading the log throws; runs
+  // before the lock is released
+  struct WaitingScope {
+    int &waiting;
+    explicit WaitingScope(int &count) : waiting(count) { ++waiting; }
+    ~WaitingScope() { --waiting; }
+  } waiting_scope{waiters.waiting};
+  while (out_messages.empty() &&
+         waiters.cv.wait_until(lock, deadline, [&] {
+           return LastMessageId(*state) > seen_id;
+         })) {
+    out_messages = ReadMessages(*state, seen_id, from_ts_ms, -1, limit);
+    seen_id = LastMessageId(*state);
+  }
 
-  out_messages = FilterMessages(room, since_id, from_ts_ms, -1);
   return ReadResult::Ok;
 }
 
+uint64_t ChatManager::PollMessagesAsync(int64_t room_id, int64_t requester_id,
+                                        int64_t since_id, int64_t from_ts_ms,
+                                        int64_t limit, PollHandler handler) {
+  RoomState *state = FindRoom(room_id);
+  if (state == nullptr) {
+    handler(ReadResult::RoomNotFound, {});
+    return 0;
+  }
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  const auto &room = state->room;
+  ReadResult result = ReadResult::Ok;
+  std::vector<Message> messages;
+  if (!room.participants.contains(requester_id)) {
+    result = ReadResult::NotInRoom;
+  } else if (LastMessageId(*state) > since_id) {
+    messages = ReadMessages(*state, since_id, from_ts_ms, -1, limit);
+  }
+
+  if (result != ReadResult::Ok || !messages.empty()) {
+    lock.unlock();
+    handler(result, std::move(messages));
+    return 0;
+  }
+
+  // Later messages can only be newer than what has been filtered already
+  const uint64_t poll_id =
+      next_poll_id_.fetch_add(1, std::memory_order_relaxed);
+  state->waiters.async_polls.emplace(
+      poll_id, AsyncPoll{std::max(since_id, LastMessageId(*state)), from_ts_ms,
+                         std::move(handler)});
+  return poll_id;
+}
+
+bool ChatManager::CancelPoll(int64_t room_id, uint64_t poll_id) {
+  RoomState *state = FindRoom(room_id);
+  if (state == nullptr) {
+    return false;
+  }
+
+  PollHandler handler;
+  {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    auto &polls = state->waiters.async_polls;
+    const auto poll_it = polls.find(poll_id);
+    if (poll_it == polls.end()) {
+      return false;
+    }
+    handler = std::move(poll_it->second.handler);
+    polls.erase(poll_it);
+  }
+  // The handler may own its caller; release it outside the lock
+  return true;
+}
+
+void ChatManager::InsertRoom(std::unique_ptr<RoomState> state) {
+  const auto index = static_cast<std::size_t>(state->room.id);
+  const std::size_t chunk_index = index >> kRoomChunkBits;
+  if (chunk_index >= kMaxRoomChunks) {
+    throw std::length_error("Too many chat rooms");
+  }
+
+  RoomChunk *chunk = room_chunks_[chunk_index].load(std::memory_order_relaxed);
+  if (chunk == nullptr) {
+    owned_chunks_.push_back(std::make_unique<RoomChunk>());
+    chunk = owned_chunks_.back().get();
+    for (auto &slot : *chunk) {
+      slot.store(nullptr, std::memory_order_relaxed);
+    }
+    room_chunks_[chunk_index].store(chunk, std::memory_order_release);
+  }
+
+  owned_rooms_.push_back(std::move(state));
+  (*chunk)[index & (kRoomChunkSize - 1)].store(owned_rooms_.back().get(),
+                                               std::memory_order_release);
+}
+
+void ChatManager::Restore() {
+  auto api_keys = std::make_shared<ApiKeyIndex>();
+  int64_t last_message_id = 0;
+
+  std::lock_guard<std::mutex> participants_lock(participants_mutex_);
+  std::lock_guard<std::mutex> rooms_lock(rooms_mutex_);
+  const auto apply = [&](const JournalRecord &record) {
+    switch (record.type) {
+    case JournalRecord::Type::Participant:
+    case JournalRecord::Type::ParticipantKeyHash:
+      participants_[record.id] = Participant{record.id, record.name, {}};
+      (*api_keys)[record.type == JournalRecord::Type::Participant
+                      ? Sha256(record.api_key)
+                      : record.api_key] = record.id;
+      next_participant_id_ = std::max(next_participant_id_, record.id + 1);
+      break;
+
+    case JournalRecord::Type::Room: {
+      auto state = std::make_unique<RoomState>();
+      state->room.id = record.id;
+      state->room.name = record.name;
+      state->room.participants.insert(record.participant_id);
+      // History stays on disk; the tail refills with new messages
+      state->log = std::make_unique<MessageLog>(
+          RoomLogDir(*storage_, record.id), record.id, storage_->segment_bytes);
+      state->last_message_id = state->log->LastId();
+      state->last_created_at_ms = state->log->LastCreatedAtMs();
+      state->evicted_id = state->last_message_id;
+      state->evicted_created_at_ms = state->last_created_at_ms;
+      last_message_id = std::max(last_message_id, state->last_message_id);
+      next_room_id_ = std::max(next_room_id_, record.id + 1);
+      InsertRoom(std::move(state));
+      break;
+    }
+
+    case JournalRecord::Type::Join:
+    case JournalRecord::Type::Leave:
+      if (RoomState *state = FindRoom(record.id)) {
+        if (record.type == JournalRecord::Type::Join) {
+          state->room.participants.insert(record.participant_id);
+        } else {
+          state->room.participants.erase(record.participant_id);
+        }
+      }
+      break;
+    }
+  };
+  ChatJournal::Replay(storage_->dir / kJournalFile, apply);
+
+  api_keys_.store(std::move(api_keys), std::memory_order_release);
+  api_keys_version_.fetch_add(1, std::memory_order_release);
+  next_message_id_.store(last_message_id + 1, std::memory_order_relaxed);
+}
+
+void ChatManager::Journal(const JournalRecord &record) {
+  if (journal_) {
+    journal_->Append(record);
+  }
+}
+
+ChatManager::RoomState *ChatManager::FindRoom(int64_t room_id) const {
+  if (room_id <= 0) {
+    return nullptr;
+  }
+
+  const auto index = static_cast<std::size_t>(room_id);
+  const std::size_t chunk_index = index >> kRoomChunkBits;
+  if (chunk_index >= kMaxRoomChunks) {
+    return nullptr;
+  }
+
+  const RoomChunk *chunk =
+      room_chunks_[chunk_index].load(std::memory_order_acquire);
+  if (chunk == nullptr) {
+    return nullptr;
+  }
+  return (*chunk)[index & (kRoomChunkSize - 1)].load(std::memory_order_acquire);
+}
+
+const ChatManager::ApiKeyIndex &ChatManager::CurrentApiKeys() const {
+  struct Cache {
+    uint64_t owner = 0;
+    uint64_t version = 0;
+    std::shared_ptr<const ApiKeyIndex> api_keys;
+  };
+  thread_local Cache cache;
+
+  const uint64_t version = api_keys_version_.load(std::memory_order_acquire);
+  if (cache.owner != instance_id_ || cache.version != version ||
+      !cache.api_keys) {
+    // The index loaded here is at least as new as version
+    cache.api_keys = api_keys_.load(std::memory_order_acquire);
+    cache.owner = instance_id_;
+    cache.version = version;
+  }
+  return *cache.api_keys;
+}
+
 int64_t ChatManager::NowUnixMs() {
   const auto now = std::chrono::system_clock::now();
   return std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -199,30 +520,55 @@ int64_t ChatManager::NowUnixMs() {
       .count();
 }
 
+int64_t ChatManager::LastMessageId(const RoomState &state) {
+  return state.last_message_id;
+}
+
+std::vector<Message> ChatManager::ReadMessages(const RoomState &state,
+                                               int64_t since_id,
+                                               int64_t from_ts_ms,
+                                               int64_t to_ts_ms,
+                                               int64_t limit) {
+  // The tail holds every message newer than the last evicted one
+  const bool tail_covers =
+      state.evicted_id == 0 || since_id >= state.evicted_id ||
+      (from_ts_ms > 0 && from_ts_ms > state.evicted_created_at_ms);
+  if (tail_covers) {
+    return FilterMessages(state.room, since_id, from_ts_ms, to_ts_ms, limit);
+  }
+  return state.log->Read(since_id, from_ts_ms, to_ts_ms, limit);
+}
+
 std::vector<Message> ChatManager::FilterMessages(const ChatRoom &room,
                                                  int64_t since_id,
                                                  int64_t from_ts_ms,
-                                                 int64_t to_ts_ms) {
-  std::vector<Message> result;
-  result.reserve(room.messages.size());
-
-  for (const auto &message : room.messages) {
-    if (message.id <= since_id) {
-      continue;
-    }
-
-    if (from_ts_ms > 0 && message.created_at_ms < from_ts_ms) {
-      continue;
-    }
+                                                 int64_t to_ts_ms,
+                                                 int64_t limit) {
+  const auto &messages = room.messages;
+  auto first = std::upper_bound(
+      messages.begin(), messages.end(), since_id,
+      [](int64_t id, const Message &message) { return id < message.id; });
+
+  if (from_ts_ms > 0) {
+    first = std::lower_bound(first, messages.end(), from_ts_ms,
+                             [](const Message &message, int64_t ts) {
+                               return message.created_at_ms < ts;
+                             });
+  }
 
-    if (to_ts_ms > 0 && message.created_at_ms > to_ts_ms) {
-      continue;
-    }
+  auto last = messages.end();
+  if (to_ts_ms > 0) {
+    last = std::upper_bound(first, messages.end(), to_ts_ms,
+                            [](int64_t ts, const Message &message) {
+                              return ts < message.created_at_ms;
+                            });
+  }
 
-    result.push_back(message);
+  if (limit > 0 && last - first > limit) {
+    last = first + limit;
   }
 
-  return result;
+  return std::vector<Message>(first, last);
 }
 
 std::string ChatManager::GenerateApiKey() {
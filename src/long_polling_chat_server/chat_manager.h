@@ -1,7 +1,13 @@
 ﻿#pragma once
 
+#include <array>
+#include <atomic>
 #include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <random>
@@ -32,11 +38,36 @@ struct ChatRoom {
   int64_t id{};
   std::string name;
   std::unordered_set<int64_t> participants;
-  std::vector<Message> messages;
+  // Newest messages, ordered by id and by created_at_ms, so reads locate
+  // ranges by binary search. With storage enabled this is a bounded tail
+  // and older messages live only in the room's MessageLog
+  std::deque<Message> messages;
 };
 
+struct StorageOptions {
+  // Holds chat.journal and one MessageLog directory per room
+  std::filesystem::path dir;
+  uint64_t segment_bytes{8 << 20};
+  // Messages kept in memory per room
+  std::size_t memory_tail{1000};
+};
+
+class ChatJournal;
+class MessageLog;
+struct JournalRecord;
+
+// Locking: each room has its own mutex for membership, messages and
+// waiters, so independent rooms do not contend. Room lookup and
+// authentication take no locks at all
 class ChatManager {
 public:
+  // Everything in memory; history grows without bound
+  ChatManager();
+  // Persists participants, rooms and messages under storage.dir and
+  // restores whatever an earlier run left there
+  explicit ChatManager(const StorageOptions &storage);
+  ~ChatManager();
+
   enum class RoomMutationResult {
     Ok,
     RoomNotFound,
@@ -59,6 +90,9 @@ public:
     NotInRoom
   };
 
+  using PollHandler =
+      std::function<void(ReadResult result, std::vector<Message> messages)>;
+
   Participant CreateParticipant(const std::string &name);
   bool Authenticate(const std::string &api_key, int64_t &participant_id) const;
 
@@ -76,33 +110,119 @@ public:
                                 const std::string &image_url,
                                 Message &created_message);
 
+  // limit > 0 returns at most limit oldest matching messages; a reader
+  // continues from the id of the last one
   ReadResult GetMessages(int64_t room_id, int64_t requester_id, int64_t since_id,
-                         int64_t from_ts_ms, int64_t to_ts_ms,
+                         int64_t from_ts_ms, int64_t to_ts_ms, int64_t limit,
                          std::vector<Message> &out_messages) const;
 
   ReadResult PollMessages(int64_t room_id, int64_t requester_id, int64_t since_id,
-                          int64_t from_ts_ms, int timeout_seconds,
+                          int64_t from_ts_ms, int timeout_seconds, int64_t limit,
                           std::vector<Message> &out_messages);
 
+  // Non-blocking PollMessages for event-driven transports. The handler is
+  // called exactly once, without the room lock held: right away when the
+  // poll fails or messages are already available, or later from
+  // CreateMessage. Returns the id to pass to CancelPoll, or 0 if the handler
+  // has already been called. Throws without calling the handler if reading
+  // the stored history fails
+  uint64_t PollMessagesAsync(int64_t room_id, int64_t requester_id,
+                             int64_t since_id, int64_t from_ts_ms,
+                             int64_t limit, PollHandler handler);
+  // Drops a pending poll (e.g. on timeout) without calling its handler.
+  // Returns false if the handler has already been taken by CreateMessage
+  bool CancelPoll(int64_t room_id, uint64_t poll_id);
+
 private:
+  struct AsyncPoll {
+    int64_t since_id{};
+    int64_t from_ts_ms{};
+    PollHandler handler;
+  };
+
+  // Long-pollers of one room. Posting a message wakes only this room's
+  // waiters, and they re-check it in O(1) via LastMessageId
+  struct RoomWaiters {
+    std::condition_variable cv;
+    int waiting{};
+    std::unordered_map<uint64_t, AsyncPoll> async_polls;
+  };
+
+  struct RoomState {
+    mutable std::mutex mutex;
+    ChatRoom room;
+    RoomWaiters waiters;
+    // Null without storage
+    std::unique_ptr<MessageLog> log;
+    int64_t last_message_id{};
+    int64_t last_created_at_ms{};
+    // Newest message that is no longer in room.messages; 0 if none
+    int64_t evicted_id{};
+    int64_t evicted_created_at_ms{};
+  };
+
+  // Rooms by id: ids are dense and rooms are never removed, so a lookup is
+  // two acquire loads in a two-level table filled under rooms_mutex_
+  static constexpr std::size_t kRoomChunkBits = 12;
+  static constexpr std::size_t kRoomChunkSize = std::size_t{1} << kRoomChunkBits;
+  static constexpr std::size_t kMaxRoomChunks = 4096;
+  using RoomChunk = std::array<std::atomic<RoomState *>, kRoomChunkSize>;
+
+  // Immutable Sha256(API key) -> participant id map, so neither the journal
+  // nor memory keeps the keys themselves. CreateParticipant publishes a
+  // new copy; readers keep a per-thread reference to the current copy and
+  // reload it only when api_keys_version_ changes, so Authenticate does no
+  // atomic read-modify-write on shared memory
+  using ApiKeyIndex = std::unordered_map<std::string, int64_t>;
+
+  RoomState *FindRoom(int64_t room_id) const;
+  // Publishes a room under its id; rooms_mutex_ must be held
+  void InsertRoom(std::unique_ptr<RoomState> state);
+  void Restore();
+  void Journal(const JournalRecord &record);
+  // Valid until the calling thread's next call
+  const ApiKeyIndex &CurrentApiKeys() const;
+
   static int64_t NowUnixMs();
+  static int64_t LastMessageId(const RoomState &state);
+  // Serves the range from the in-memory tail when it covers it and from the
+  // room's MessageLog otherwise; the room lock stays held while reading
+  static std::vector<Message> ReadMessages(const RoomState &state,
+                                           int64_t since_id,
+                                           int64_t from_ts_ms,
+                                           int64_t to_ts_ms, int64_t limit);
+  // O(log n + k): bounds are found by binary search, only matches are copied
   static std::vector<Message> FilterMessages(const ChatRoom &room,
                                              int64_t since_id,
                                              int64_t from_ts_ms,
-                                             int64_t to_ts_ms);
+                                             int64_t to_ts_ms, int64_t limit);
 
   std::string GenerateApiKey();
 
 private:
-  mutable std::mutex mutex_;
-  std::condition_variable cv_;
+  const uint64_t instance_id_;
+
+  // Guards participants_, rng_ and publication of api_keys_
+  std::mutex participants_mutex_;
   std::unordered_map<int64_t, Participant> participants_;
-  std::unordered_map<std::string, int64_t> api_key_index_;
-  std::unordered_map<int64_t, ChatRoom> rooms_;
+  std::atomic<std::shared_ptr<const ApiKeyIndex>> api_keys_;
+  std::atomic<uint64_t> api_keys_version_{0};
   int64_t next_participant_id_{1};
-  int64_t next_room_id_{1};
-  int64_t next_message_id_{1};
   std::mt19937_64 rng_{std::random_device{}()};
+
+  // Guards room creation only
+  std::mutex rooms_mutex_;
+  std::unique_ptr<std::atomic<RoomChunk *>[]> room_chunks_;
+  std::vector<std::unique_ptr<RoomChunk>> owned_chunks_;
+  std::vector<std::unique_ptr<RoomState>> owned_rooms_;
+  int64_t next_room_id_{1};
+
+  std::atomic<int64_t> next_message_id_{1};
+  std::atomic<uint64_t> next_poll_id_{1};
+
+  // Storage; journal_ is null when it is disabled
+  std::optional<StorageOptions> storage_;
+  std::unique_ptr<ChatJournal> journal_;
 };
 
 } // namespace Chat
@@ -1,13 +1,21 @@
 ﻿#include "chat_manager.h"
+#include "message_json.h"
+#include "poll_server.h"
 
 #include "httplib.h"
 #include "logger.h"
 
+#include <algorithm>
+#include <boost/asio.hpp>
 #include <filesystem>
 #include <iostream>
+#include <memory>
 #include <nlohmann/json.hpp>
+#include <optional>
 #include <string>
+#include <thread>
 #include <toml.hpp>
+#include <vector>
 
 using json = nlohmann::json;
 using namespace httplib;
@@ -29,16 +37,6 @@ void SendError(Response &res, int status, const std::string &message) {
                   "application/json");
 }
 
-json MessageToJson(const Chat::Message &message) {
-  return json{{"id", message.id},
-              {"roomId", message.room_id},
-              {"authorId", message.author_id},
-              {"type", message.type},
-              {"text", message.text},
-              {"imageUrl", message.image_url},
-              {"createdAtMs", message.created_at_ms}};
-}
-
 std::optional<int64_t> ParseInt64(const std::string &value) {
   try {
     std::size_t pos = 0;
@@ -103,8 +101,32 @@ int main() {
         cfg["server_parameters"]["host"].value_or("0.0.0.0")};
     const unsigned short port{static_cast<unsigned short>(
         cfg["server_parameters"]["port"].value_or(17000))};
-
-    Chat::ChatManager chat_manager;
+    const bool async_poll_enabled{cfg["async_poll"]["enabled"].value_or(true)};
+    const unsigned short async_poll_port{static_cast<unsigned short>(
+        cfg["async_poll"]["port"].value_or(17001))};
+    const int async_poll_threads{cfg["async_poll"]["threads"].value_or(2)};
+
+    const bool storage_enabled{cfg["storage"]["enabled"].value_or(true)};
+    Chat::StorageOptions storage;
+    storage.dir = cfg["storage"]["dir"].value_or("./data");
+    storage.segment_bytes =
+        static_cast<uint64_t>(cfg["storage"]["segment_size_mb"].value_or(8))
+        << 20;
+    storage.memory_tail = static_cast<std::size_t>(
+        cfg["storage"]["memory_tail"].value_or(1000));
+
+    // Declared before the manager: pending async polls registered in it own
+    // sessions whose timers and sockets must be destroyed before the
+    // io_context they belong to
+    net::io_context ioc(async_poll_threads);
+
+    auto chat_manager_owner =
+        storage_enabled ? std::make_unique<Chat::ChatManager>(storage)
+                        : std::make_unique<Chat::ChatManager>();
+    Chat::ChatManager &chat_manager = *chat_manager_owner;
+    if (storage_enabled) {
+      LOG_INFO(logger.get(), "Chat storage in {}", storage.dir.string());
+    }
     Server svr;
 
     svr.new_task_queue = [] { return new ThreadPool(16); };
@@ -123,7 +145,7 @@ int main() {
       return Server::HandlerResponse::Unhandled;
     });
 
-    svr.Get("/", [](const Request &, Response &res) {
+    svr.Get("/", [&](const Request &, Response &res) {
       const json response = {
           {"name", "Long Polling Chat API"},
           {"version", "1.0.0"},
@@ -137,7 +159,9 @@ int main() {
             {"POST /rooms/{id}/messages", "Send message to room"},
             {"GET /rooms/{id}/messages", "Get messages with time filters"},
             {"GET /rooms/{id}/messages/poll", "Long polling for new messages"},
-            {"GET /health", "Health check"}}}};
+            {"GET /health", "Health check"}}},
+          {"asyncPollPort", async_poll_enabled ? json(async_poll_port)
+                                               : json(nullptr)}};
       res.set_content(response.dump(), "application/json");
     });
 
@@ -335,7 +359,8 @@ int main() {
       }
 
       res.status = 201;
-      res.set_content(MessageToJson(created_message).dump(), "application/json");
+      res.set_content(Chat::MessageToJson(created_message).dump(),
+                      "application/json");
     });
 
     svr.Get(R"(/rooms/(\d+)/messages)", [&](const Request &req, Response &res) {
@@ -348,11 +373,12 @@ int main() {
       const int64_t since_id = QueryInt64(req, "sinceId", 0);
       const int64_t from_ts = QueryInt64(req, "fromTs", 0);
       const int64_t to_ts = QueryInt64(req, "toTs", -1);
+      const int64_t limit = QueryInt64(req, "limit", 0);
 
       std::vector<Chat::Message> messages;
       const auto result = chat_manager.GetMessages(room_id, requester_id,
                                                    since_id, from_ts, to_ts,
-                                                   messages);
+                                                   limit, messages);
 
       if (result == Chat::ChatManager::ReadResult::RoomNotFound) {
         SendError(res, 404, "Room not found");
@@ -366,7 +392,7 @@ int main() {
 
       json items = json::array();
       for (const auto &message : messages) {
-        items.push_back(MessageToJson(message));
+        items.push_back(Chat::MessageToJson(message));
       }
 
       res.set_content(items.dump(), "application/json");
@@ -383,6 +409,7 @@ int main() {
               const int64_t room_id = std::stoll(req.matches[1].str());
               const int64_t since_id = QueryInt64(req, "sinceId", 0);
               const int64_t from_ts = QueryInt64(req, "fromTs", 0);
+              const int64_t limit = QueryInt64(req, "limit", 0);
               int timeout = static_cast<int>(QueryInt64(req, "timeout", 25));
               if (timeout < 1) {
                 timeout = 1;
@@ -393,7 +420,8 @@ int main() {
 
               std::vector<Chat::Message> messages;
               const auto result = chat_manager.PollMessages(
-                  room_id, requester_id, since_id, from_ts, timeout, messages);
+                  room_id, requester_id, since_id, from_ts, timeout, limit,
+                  messages);
 
               if (result == Chat::ChatManager::ReadResult::RoomNotFound) {
                 SendError(res, 404, "Room not found");
@@ -412,18 +440,44 @@ int main() {
 
               json items = json::array();
               for (const auto &message : messages) {
-                items.push_back(MessageToJson(message));
+                items.push_back(Chat::MessageToJson(message));
               }
 
               res.set_content(items.dump(), "application/json");
             });
 
+    // The same poll route on a separate port, served without parking a
+    // thread per poller. The httplib route above stays for compatibility
+    std::optional<Chat::PollServer> poll_server;
+    std::vector<std::thread> poll_workers;
+    if (async_poll_enabled) {
+      poll_server.emplace(
+          ioc, tcp::endpoint(net::ip::make_address(address), async_poll_port),
+          chat_manager, logger);
+      poll_server->Run();
+
+      poll_workers.reserve(static_cast<size_t>(std::max(1, async_poll_threads)));
+      for (int i = 0; i < std::max(1, async_poll_threads); ++i) {
+        poll_workers.emplace_back([&ioc]() { ioc.run(); });
+      }
+
+      LOG_INFO(logger.get(), "Async long polling starting on {}:{}", address,
+               async_poll_port);
+      std::cout << "Async long polling started on http://" << address << ":"
+                << async_poll_port << std::endl;
+    }
+
     LOG_INFO(logger.get(), "Long polling chat server starting on {}:{}", address,
              port);
     std::cout << "Long polling chat server started on http://" << address << ":"
               << port << std::endl;
 
     svr.listen(address.c_str(), port);
+
+    ioc.stop();
+    for (auto &worker : poll_workers) {
+      worker.join();
+    }
     return 0;
 
   } catch (const std::exception &e) {
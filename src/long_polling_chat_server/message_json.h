@@ -0,0 +1,20 @@
+﻿#pragma once
+
+#include "chat_manager.h"
+
+#include <nlohmann/json.hpp>
+
+namespace Chat {
+
+// Shared by the httplib routes and the async poll transport
+inline nlohmann::json MessageToJson(const Message &message) {
+  return nlohmann::json{{"id", message.id},
+                        {"roomId", message.room_id},
+                        {"authorId", message.author_id},
+                        {"type", message.type},
+                        {"text", message.text},
+                        {"imageUrl", message.image_url},
+                        {"createdAtMs", message.created_at_ms}};
+}
+
+} // namespace Chat
@@ -0,0 +1,373 @@
+﻿#include "message_log.h"
+#include "binary_io.h"
+
+#include <algorithm>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace bip = boost::interprocess;
+
+namespace Chat {
+
+namespace {
+
+constexpr std::size_t kIndexEntrySize = 24;
+
+// Read-only view of a whole file; empty files are not mapped
+class MappedFile {
+public:
+  MappedFile(const std::filesystem::path &path, uint64_t size) {
+    if (size == 0) {
+      return;
+    }
+    mapping_ = bip::file_mapping(path.string().c_str(), bip::read_only);
+    region_ = bip::mapped_region(mapping_, bip::read_only, 0,
+                                 static_cast<std::size_t>(size));
+    data_ = std::string_view(static_cast<const char *>(region_.get_address()),
+                             region_.get_size());
+  }
+
+  std::string_view Data() const { return data_; }
+
+private:
+  bip::file_mapping mapping_;
+  bip::mapped_region region_;
+  std::string_view data_;
+};
+
+bool ParseSegmentName(const std::filesystem::path &path, int64_t &first_id) {
+  if (path.extension() != ".log") {
+    return false;
+  }
+  const std::string stem = path.stem().string();
+  if (stem.empty() ||
+      !std::all_of(stem.begin(), stem.end(),
+                   [](char ch) { return ch >= '0' && ch <= '9'; })) {
+    return false;
+  }
+  first_id = std::stoll(stem);
+  return true;
+}
+
+std::string EncodeMessage(const Message &message) {
+  std::string payload;
+  BinaryWriter writer(payload);
+  writer.I64(message.id);
+  writer.I64(message.created_at_ms);
+  writer.I64(message.author_id);
+  writer.Str(message.type);
+  writer.Str(message.text);
+  writer.Str(message.image_url);
+  return payload;
+}
+
+// Id and timestamp lead the payload, so filtering does not decode strings
+void PeekMessage(std::string_view payload, int64_t &id,
+                 int64_t &created_at_ms) {
+  BinaryReader reader(payload);
+  id = reader.I64();
+  created_at_ms = reader.I64();
+}
+
+MessageLog::IndexEntry IndexEntryAt(std::string_view data, std::size_t i) {
+  BinaryReader reader(data.substr(i * kIndexEntrySize, kIndexEntrySize));
+  MessageLog::IndexEntry entry;
+  entry.id = reader.I64();
+  entry.created_at_ms = reader.I64();
+  entry.offset = reader.U64();
+  return entry;
+}
+
+Message DecodeMessage(std::string_view payload, int64_t room_id) {
+  BinaryReader reader(payload);
+  Message message;
+  message.id = reader.I64();
+  message.created_at_ms = reader.I64();
+  message.author_id = reader.I64();
+  message.type = reader.Str();
+  message.text = reader.Str();
+  message.image_url = reader.Str();
+  message.room_id = room_id;
+  return message;
+}
+
+} // namespace
+
+MessageLog::MessageLog(std::filesystem::path dir, int64_t room_id,
+                       uint64_t segment_bytes)
+    : dir_(std::move(dir)), room_id_(room_id),
+      segment_bytes_(std::max<uint64_t>(segment_bytes, kIndexStride)) {
+  std::filesystem::create_directories(dir_);
+
+  std::vector<int64_t> first_ids;
+  for (const auto &entry : std::filesystem::directory_iterator(dir_)) {
+    int64_t first_id = 0;
+    if (entry.is_regular_file() && ParseSegmentName(entry.path(), first_id)) {
+      first_ids.push_back(first_id);
+    }
+  }
+  std::sort(first_ids.begin(), first_ids.end());
+
+  // The last segment may end with a torn record; a segment left with no
+  // records at all is dropped and the previous one becomes active
+  IndexEntry last;
+  while (!first_ids.empty()) {
+    const auto path = SegmentPath(first_ids.back());
+    uint64_t valid_bytes = 0;
+    active_index_ = ScanSegment(path, valid_bytes, last);
+    if (valid_bytes > 0) {
+      if (valid_bytes < std::filesystem::file_size(path)) {
+        std::filesystem::resize_file(path, valid_bytes);
+      }
+      active_indexed_bytes_ = active_index_.back().offset;
+      last_id_ = last.id;
+      last_created_at_ms_ = last.created_at_ms;
+      break;
+    }
+    std::filesystem::remove(path);
+    std::filesystem::remove(IndexPath(first_ids.back()));
+    first_ids.pop_back();
+  }
+
+  for (std::size_t i = 0; i < first_ids.size(); ++i) {
+    const auto path = SegmentPath(first_ids[i]);
+    Segment segment{first_ids[i], 0, std::filesystem::file_size(path)};
+    if (i + 1 == first_ids.size()) {
+      segment.first_created_at_ms = active_index_.front().created_at_ms;
+      segments_.push_back(segment);
+      break;
+    }
+
+    // Sealed segments only need their first record here; a missing or
+    // stale index is rebuilt
+    IndexEntry first;
+    if (!ReadFirstIndexEntry(segment.first_id, first) ||
+        first.id != segment.first_id) {
+      uint64_t valid_bytes = 0;
+      const auto index = ScanSegment(path, valid_bytes, last);
+      WriteIndex(segment.first_id, index);
+      first = index.empty() ? IndexEntry{} : index.front();
+    }
+    segment.first_created_at_ms = first.created_at_ms;
+    segments_.push_back(segment);
+  }
+}
+
+void MessageLog::Append(const Message &message) {
+  std::string record;
+  AppendRecord(record, EncodeMessage(message));
+
+  if (segments_.empty() || segments_.back().bytes >= segment_bytes_) {
+    if (!segments_.empty()) {
+      Seal();
+    }
+    segments_.push_back(Segment{message.id, message.created_at_ms, 0});
+    active_index_.clear();
+    active_indexed_bytes_ = 0;
+  }
+
+  // The segment is opened for each append instead of being kept open: with
+  // thousands of rooms, one descriptor per room would exhaust the process
+  // limit and make accept() fail
+  auto &active = segments_.back();
+  const auto path = SegmentPath(active.first_id);
+  std::FILE *file = std::fopen(path.string().c_str(), "ab");
+  if (file == nullptr) {
+    throw std::runtime_error("Failed to open message log: " + path.string());
+  }
+
+  bool written =
+      std::fwrite(record.data(), 1, record.size(), file) == record.size();
+  written = std::fclose(file) == 0 && written;
+  if (!written) {
+    // Drop whatever part of the record made it out so later appends
+    // continue from a clean boundary
+    std::error_code ec;
+    std::filesystem::resize_file(path, active.bytes, ec);
+    throw std::runtime_error("Failed to append to message log: " +
+                             path.string());
+  }
+
+  if (active_index_.empty() ||
+      active.bytes - active_indexed_bytes_ >= kIndexStride) {
+    active_index_.push_back(
+        IndexEntry{message.id, message.created_at_ms, active.bytes});
+    active_indexed_bytes_ = active.bytes;
+  }
+  active.bytes += record.size();
+  last_id_ = message.id;
+  last_created_at_ms_ = message.created_at_ms;
+}
+
+std::vector<Message> MessageLog::Read(int64_t since_id, int64_t from_ts_ms,
+                                      int64_t to_ts_ms, int64_t limit) const {
+  std::vector<Message> out;
+  // Records are ordered by id and by timestamp, so the matching ones start
+  // where this turns true and stay matching up to to_ts_ms
+  const auto starts = [&](int64_t id, int64_t created_at_ms) {
+    return id > since_id && (from_ts_ms <= 0 || created_at_ms >= from_ts_ms);
+  };
+
+  // The range can begin inside the segment before the first one whose first
+  // record matches
+  std::size_t seg = static_cast<std::size_t>(
+      std::partition_point(segments_.begin(), segments_.end(),
+                           [&](const Segment &segment) {
+                             return !starts(segment.first_id,
+                                            segment.first_created_at_ms);
+                           }) -
+      segments_.begin());
+  if (seg > 0) {
+    --seg;
+  }
+
+  for (bool first = true; seg < segments_.size(); ++seg, first = false) {
+    const auto &segment = segments_[seg];
+    if (segment.bytes == 0) {
+      continue;
+    }
+
+    // Start after the last indexed record that precedes the range
+    std::size_t offset = 0;
+    if (first && seg + 1 == segments_.size()) {
+      const auto it = std::partition_point(
+          active_index_.begin(), active_index_.end(),
+          [&](const IndexEntry &entry) {
+            return !starts(entry.id, entry.created_at_ms);
+          });
+      if (it != active_index_.begin()) {
+        offset = static_cast<std::size_t>(std::prev(it)->offset);
+      }
+    } else if (first) {
+      const auto path = IndexPath(segment.first_id);
+      std::error_code ec;
+      const uint64_t size = std::filesystem::file_size(path, ec);
+      const MappedFile index(path, ec ? 0 : size - size % kIndexEntrySize);
+      std::size_t low = 0;
+      std::size_t high = index.Data().size() / kIndexEntrySize;
+      while (low < high) {
+        const std::size_t mid = low + (high - low) / 2;
+        const auto entry = IndexEntryAt(index.Data(), mid);
+        if (starts(entry.id, entry.created_at_ms)) {
+          high = mid;
+        } else {
+          low = mid + 1;
+        }
+      }
+      if (low > 0) {
+        offset = static_cast<std::size_t>(
+            IndexEntryAt(index.Data(), low - 1).offset);
+      }
+    }
+
+    const MappedFile file(SegmentPath(segment.first_id), segment.bytes);
+    std::string_view payload;
+    while (NextRecord(file.Data(), offset, payload)) {
+      int64_t id = 0;
+      int64_t created_at_ms = 0;
+      PeekMessage(payload, id, created_at_ms);
+      if (!starts(id, created_at_ms)) {
+        continue;
+      }
+      if (to_ts_ms > 0 && created_at_ms > to_ts_ms) {
+        return out;
+      }
+
+      out.push_back(DecodeMessage(payload, room_id_));
+      if (limit > 0 && static_cast<int64_t>(out.size()) >= limit) {
+        return out;
+      }
+    }
+  }
+  return out;
+}
+
+std::filesystem::path MessageLog::SegmentPath(int64_t first_id) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%020lld.log",
+                static_cast<long long>(first_id));
+  return dir_ / name;
+}
+
+std::filesystem::path MessageLog::IndexPath(int64_t first_id) const {
+  auto path = SegmentPath(first_id);
+  path.replace_extension(".idx");
+  return path;
+}
+
+std::vector<MessageLog::IndexEntry>
+MessageLog::ScanSegment(const std::filesystem::path &path,
+                        uint64_t &valid_bytes, IndexEntry &last) const {
+  std::vector<IndexEntry> index;
+  const MappedFile file(path, std::filesystem::file_size(path));
+
+  std::size_t offset = 0;
+  uint64_t indexed_bytes = 0;
+  std::string_view payload;
+  for (std::size_t start = 0; NextRecord(file.Data(), offset, payload);
+       start = offset) {
+    PeekMessage(payload, last.id, last.created_at_ms);
+    last.offset = start;
+    if (index.empty() || start - indexed_bytes >= kIndexStride) {
+      index.push_back(last);
+      indexed_bytes = start;
+    }
+  }
+
+  if (offset < file.Data().size() && !TornRecord(file.Data(), offset)) {
+    throw std::runtime_error("Message log " + path.string() +
+                             " is corrupted at offset " +
+                             std::to_string(offset));
+  }
+
+  valid_bytes = index.empty() ? 0 : offset;
+  return index;
+}
+
+bool MessageLog::ReadFirstIndexEntry(int64_t first_id,
+                                     IndexEntry &entry) const {
+  std::ifstream in(IndexPath(first_id), std::ios::binary);
+  std::string data(kIndexEntrySize, '\0');
+  if (!in.read(data.data(), static_cast<std::streamsize>(data.size()))) {
+    return false;
+  }
+  entry = IndexEntryAt(data, 0);
+  return true;
+}
+
+void MessageLog::WriteIndex(int64_t first_id,
+                            const std::vector<IndexEntry> &index) const {
+  std::string data;
+  BinaryWriter writer(data);
+  for (const auto &entry : index) {
+    writer.I64(entry.id);
+    writer.I64(entry.created_at_ms);
+    writer.U64(entry.offset);
+  }
+
+  // Written aside and renamed, so a crash never leaves a partial index
+  const auto path = IndexPath(first_id);
+  auto tmp = path;
+  tmp += ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!out) {
+      throw std::runtime_error("Failed to write message log index: " +
+                               tmp.string());
+    }
+  }
+  std::filesystem::rename(tmp, path);
+}
+
+void MessageLog::Seal() {
+  WriteIndex(segments_.back().first_id, active_index_);
+}
+
+} // namespace Chat
@@ -0,0 +1,83 @@
+﻿#pragma once
+
+#include "chat_manager.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace Chat {
+
+// Append-only history of one room on disk. Messages go to segment files
+// named after their first message id; a segment is sealed once it reaches
+// segment_bytes. Every sealed segment has a sparse index file with the id,
+// timestamp and offset of roughly one record per kIndexStride bytes, so a
+// read maps the index and the segments and jumps straight to its range.
+// Appends are flushed to the OS, which survives a process crash but not a
+// power loss. No file stays open between calls. Not thread-safe: the owning room's lock serializes access
+class MessageLog {
+public:
+  static constexpr uint64_t kIndexStride = 4096;
+
+  // Opens the log in dir, creating it if needed. A torn record left at the
+  // end of the last segment by a crash is cut off; a bad record anywhere
+  // else throws
+  MessageLog(std::filesystem::path dir, int64_t room_id,
+             uint64_t segment_bytes);
+
+  MessageLog(const MessageLog &) = delete;
+  MessageLog &operator=(const MessageLog &) = delete;
+
+  void Append(const Message &message);
+
+  // Same filter as ChatManager::GetMessages over the whole history
+  std::vector<Message> Read(int64_t since_id, int64_t from_ts_ms,
+                            int64_t to_ts_ms, int64_t limit) const;
+
+  // 0 when the log is empty
+  int64_t LastId() const { return last_id_; }
+  int64_t LastCreatedAtMs() const { return last_created_at_ms_; }
+
+  // One sampled record of a segment, stored little-endian in .idx files
+  struct IndexEntry {
+    int64_t id{};
+    int64_t created_at_ms{};
+    uint64_t offset{};
+  };
+
+private:
+  struct Segment {
+    int64_t first_id{};
+    int64_t first_created_at_ms{};
+    uint64_t bytes{};
+  };
+
+  std::filesystem::path SegmentPath(int64_t first_id) const;
+  std::filesystem::path IndexPath(int64_t first_id) const;
+
+  // Scans a segment, returning its sparse index and the size of its valid
+  // prefix; last receives the final valid record. Throws if the valid
+  // prefix is followed by anything but a torn record
+  std::vector<IndexEntry> ScanSegment(const std::filesystem::path &path,
+                                      uint64_t &valid_bytes,
+                                      IndexEntry &last) const;
+  bool ReadFirstIndexEntry(int64_t first_id, IndexEntry &entry) const;
+  void WriteIndex(int64_t first_id, const std::vector<IndexEntry> &index) const;
+  void Seal();
+
+  const std::filesystem::path dir_;
+  const int64_t room_id_;
+  const uint64_t segment_bytes_;
+
+  // Sealed segments followed by the active one, in id order
+  std::vector<Segment> segments_;
+  // Sparse index of the active segment; sealed ones keep theirs on disk
+  std::vector<IndexEntry> active_index_;
+  uint64_t active_indexed_bytes_{0};
+
+  int64_t last_id_{0};
+  int64_t last_created_at_ms_{0};
+};
+
+} // namespace Chat
@@ -0,0 +1,53 @@
+﻿#include "poll_server.h"
+#include "poll_session.h"
+
+namespace Chat {
+
+PollServer::PollServer(net::io_context &ioc, const tcp::endpoint &endpoint,
+                       ChatManager &manager, Logging::Logger &logger)
+    : ioc_(ioc), acceptor_(ioc), manager_(manager), logger_(logger) {
+  beast::error_code ec;
+
+  acceptor_.open(endpoint.protocol(), ec);
+  if (ec) {
+    throw std::runtime_error("Failed to open acceptor: " + ec.message());
+  }
+
+  acceptor_.set_option(net::socket_base::reuse_address(true), ec);
+  if (ec) {
+    throw std::runtime_error("Failed to set socket option: " + ec.message());
+  }
+
+  acceptor_.bind(endpoint, ec);
+  if (ec) {
+    throw std::runtime_error("Failed to bind endpoint: " + ec.message());
+  }
+
+  acceptor_.listen(net::socket_base::max_listen_connections, ec);
+  if (ec) {
+    throw std::runtime_error("Failed to listen: " + ec.message());
+  }
+}
+
+void PollServer::Run() { DoAccept(); }
+
+ChatManager &PollServer::GetManager() { return manager_; }
+
+Logging::Logger &PollServer::GetLogger() { return logger_; }
+
+void PollServer::DoAccept() {
+  acceptor_.async_accept(net::make_strand(ioc_),
+                         beast::bind_front_handler(&PollServer::OnAccept, this));
+}
+
+void PollServer::OnAccept(beast::error_code ec, tcp::socket socket) {
+  if (ec) {
+    LOG_ERROR(logger_.get(), "Poll accept error: {}", ec.message());
+  } else {
+    std::make_shared<PollSession>(std::move(socket), *this)->Run();
+  }
+
+  DoAccept();
+}
+
+} // namespace Chat
@@ -0,0 +1,39 @@
+﻿#pragma once
+
+#include "chat_manager.h"
+#include "logger.h"
+
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+
+namespace beast = boost::beast;
+namespace net = boost::asio;
+using tcp = boost::asio::ip::tcp;
+
+namespace Chat {
+
+// Event-driven transport for GET /rooms/{id}/messages/poll on its own port.
+// A parked poll is a registration in ChatManager plus a timer, not a blocked
+// thread, so a few io_context threads serve tens of thousands of pollers
+class PollServer {
+public:
+  PollServer(net::io_context &ioc, const tcp::endpoint &endpoint,
+             ChatManager &manager, Logging::Logger &logger);
+
+  void Run();
+
+  ChatManager &GetManager();
+  Logging::Logger &GetLogger();
+
+private:
+  void DoAccept();
+  void OnAccept(beast::error_code ec, tcp::socket socket);
+
+private:
+  net::io_context &ioc_;
+  tcp::acceptor acceptor_;
+  ChatManager &manager_;
+  Logging::Logger &logger_;
+};
+
+} // namespace Chat
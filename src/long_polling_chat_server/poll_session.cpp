@@ -0,0 +1,259 @@
+﻿#include "poll_session.h"
+#include "message_json.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <exception>
+#include <string_view>
+
+namespace Chat {
+
+namespace {
+
+constexpr auto kReadTimeout = std::chrono::seconds(30);
+constexpr std::string_view kRoomsPrefix = "/rooms/";
+constexpr std::string_view kPollSuffix = "/messages/poll";
+
+bool ParseInt64(std::string_view text, int64_t &value) {
+  const auto [end, ec] =
+      std::from_chars(text.data(), text.data() + text.size(), value);
+  return ec == std::errc() && end == text.data() + text.size();
+}
+
+// Same defaults as the httplib routes: a missing or malformed value yields
+// default_value
+int64_t QueryInt64(std::string_view query, std::string_view name,
+                   int64_t default_value) {
+  while (!query.empty()) {
+    const auto amp = query.find('&');
+    const auto pair = query.substr(0, amp);
+    query = amp == std::string_view::npos ? std::string_view()
+                                          : query.substr(amp + 1);
+
+    const auto eq = pair.find('=');
+    if (eq != std::string_view::npos && pair.substr(0, eq) == name) {
+      int64_t value = 0;
+      return ParseInt64(pair.substr(eq + 1), value) ? value : default_value;
+    }
+  }
+  return default_value;
+}
+
+// "/rooms/{id}/messages/poll"
+bool ParsePollPath(std::string_view path, int64_t &room_id) {
+  if (!path.starts_with(kRoomsPrefix) || !path.ends_with(kPollSuffix)) {
+    return false;
+  }
+
+  const auto id = path.substr(kRoomsPrefix.size(), path.size() -
+                                                       kRoomsPrefix.size() -
+                                                       kPollSuffix.size());
+  return !id.empty() && std::all_of(id.begin(), id.end(), [](char c) {
+    return c >= '0' && c <= '9';
+  }) && ParseInt64(id, room_id);
+}
+
+} // namespace
+
+PollSession::PollSession(tcp::socket &&socket, PollServer &server)
+    : stream_(std::move(socket)), server_(server),
+      timer_(stream_.get_executor()) {}
+
+void PollSession::Run() {
+  net::dispatch(stream_.get_executor(),
+                beast::bind_front_handler(&PollSession::DoRead,
+                                          shared_from_this()));
+}
+
+void PollSession::DoRead() {
+  request_ = {};
+  stream_.expires_after(kReadTimeout);
+  http::async_read(stream_, buffer_, request_,
+                   beast::bind_front_handler(&PollSession::OnRead,
+                                             shared_from_this()));
+}
+
+void PollSession::OnRead(beast::error_code ec, std::size_t bytes_transferred) {
+  (void)bytes_transferred;
+
+  if (ec == http::error::end_of_stream) {
+    DoClose();
+    return;
+  }
+
+  if (ec) {
+    if (ec != beast::error::timeout) {
+      LOG_ERROR(server_.GetLogger().get(), "Poll read error: {}", ec.message());
+    }
+    return;
+  }
+
+  HandleRequest();
+}
+
+void PollSession::HandleRequest() {
+  const std::string_view target(request_.target().data(),
+                                request_.target().size());
+  const auto question = target.find('?');
+  const auto path = target.substr(0, question);
+  const auto query = question == std::string_view::npos
+                         ? std::string_view()
+                         : target.substr(question + 1);
+
+  int64_t room_id = 0;
+  if (!ParsePollPath(path, room_id)) {
+    SendError(http::status::not_found, "Not found");
+    return;
+  }
+
+  if (request_.method() != http::verb::get) {
+    SendError(http::status::method_not_allowed, "Method not allowed");
+    return;
+  }
+
+  const auto api_key = request_["X-API-Key"];
+  if (api_key.empty()) {
+    SendError(http::status::unauthorized, "Missing X-API-Key header");
+    return;
+  }
+
+  int64_t requester_id = 0;
+  if (!server_.GetManager().Authenticate(
+          std::string(api_key.data(), api_key.size()), requester_id)) {
+    SendError(http::status::unauthorized, "Invalid API key");
+    return;
+  }
+
+  const int64_t timeout = std::clamp<int64_t>(
+      QueryInt64(query, "timeout", 25), 1, 60);
+  StartPoll(room_id, requester_id, QueryInt64(query, "sinceId", 0),
+            QueryInt64(query, "fromTs", 0), static_cast<int>(timeout),
+            QueryInt64(query, "limit", 0));
+}
+
+void PollSession::StartPoll(int64_t room_id, int64_t requester_id,
+                            int64_t since_id, int64_t from_ts,
+                            int timeout_seconds, int64_t limit) {
+  // The timer bounds the poll instead of the stream timeout
+  stream_.expires_never();
+  polling_ = true;
+  poll_room_id_ = room_id;
+
+  // Called by ChatManager on whichever thread posts the message
+  auto handler = [self = shared_from_this()](ChatManager::ReadResult result,
+                                             std::vector<Message> messages) {
+    net::post(self->stream_.get_executor(),
+              [self, result, messages = std::move(messages)]() mutable {
+                self->OnPollComplete(result, std::move(messages));
+              });
+  };
+
+  // Reading history older than the in-memory tail maps log files, which
+  // can throw (e.g. out of file descriptors); an exception must not escape
+  // ioc.run(). The handler is only called once the read has succeeded
+  try {
+    poll_id_ = server_.GetManager().PollMessagesAsync(
+        room_id, requester_id, since_id, from_ts, limit, std::move(handler));
+  } catch (const std::exception &e) {
+    LOG_ERROR(server_.GetLogger().get(), "Poll failed: {}", e.what());
+    polling_ = false;
+    SendError(http::status::internal_server_error, "Internal server error");
+    return;
+  }
+  if (poll_id_ == 0) {
+    return;
+  }
+
+  timer_.expires_after(std::chrono::seconds(timeout_seconds));
+  timer_.async_wait(beast::bind_front_handler(&PollSession::OnTimeout,
+                                              shared_from_this()));
+}
+
+void PollSession::OnPollComplete(ChatManager::ReadResult result,
+                                 std::vector<Message> messages) {
+  if (!polling_) {
+    return;
+  }
+  polling_ = false;
+  timer_.cancel();
+
+  if (result == ChatManager::ReadResult::RoomNotFound) {
+    SendError(http::status::not_found, "Room not found");
+    return;
+  }
+
+  if (result == ChatManager::ReadResult::NotInRoom) {
+    SendError(http::status::forbidden, "Requester is not in room");
+    return;
+  }
+
+  json items = json::array();
+  for (const auto &message : messages) {
+    items.push_back(MessageToJson(message));
+  }
+  SendResponse(http::status::ok, items.dump());
+}
+
+void PollSession::OnTimeout(beast::error_code ec) {
+  if (ec == net::error::operation_aborted || !polling_) {
+    return;
+  }
+
+  // If the poll has just been completed, OnPollComplete is already queued
+  // on this strand and will answer instead
+  if (!server_.GetManager().CancelPoll(poll_room_id_, poll_id_)) {
+    return;
+  }
+
+  polling_ = false;
+  SendResponse(http::status::no_content, {});
+}
+
+void PollSession::SendResponse(http::status status, std::string body) {
+  const bool keep_alive = request_.keep_alive();
+
+  response_ = {};
+  response_.result(status);
+  response_.version(request_.version());
+  response_.keep_alive(keep_alive);
+  response_.set(http::field::access_control_allow_origin, "*");
+  if (status != http::status::no_content) {
+    response_.set(http::field::content_type, "application/json");
+    response_.body() = std::move(body);
+  }
+  response_.prepare_payload();
+
+  stream_.expires_after(kReadTimeout);
+  http::async_write(stream_, response_,
+                    beast::bind_front_handler(&PollSession::OnWrite,
+                                              shared_from_this(), keep_alive));
+}
+
+void PollSession::SendError(http::status status, const std::string &message) {
+  SendResponse(status, json{{"error", true}, {"message", message}}.dump());
+}
+
+void PollSession::OnWrite(bool keep_alive, beast::error_code ec,
+                          std::size_t bytes_transferred) {
+  (void)bytes_transferred;
+
+  if (ec) {
+    LOG_ERROR(server_.GetLogger().get(), "Poll write error: {}", ec.message());
+    return;
+  }
+
+  if (!keep_alive) {
+    DoClose();
+    return;
+  }
+
+  DoRead();
+}
+
+void PollSession::DoClose() {
+  beast::error_code ec;
+  stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
+}
+
+} // namespace Chat
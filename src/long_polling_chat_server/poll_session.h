@@ -0,0 +1,60 @@
+﻿#pragma once
+
+#include "poll_server.h"
+
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <cstdint>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = boost::asio::ip::tcp;
+using json = nlohmann::json;
+
+namespace Chat {
+
+// One keep-alive HTTP connection of PollServer. All handlers run on the
+// connection's strand; while a poll is parked nothing holds a thread, only
+// the ChatManager registration and timer_ keep the session alive
+class PollSession : public std::enable_shared_from_this<PollSession> {
+public:
+  PollSession(tcp::socket &&socket, PollServer &server);
+
+  void Run();
+
+private:
+  void DoRead();
+  void OnRead(beast::error_code ec, std::size_t bytes_transferred);
+  void HandleRequest();
+
+  void StartPoll(int64_t room_id, int64_t requester_id, int64_t since_id,
+                 int64_t from_ts, int timeout_seconds, int64_t limit);
+  void OnPollComplete(ChatManager::ReadResult result,
+                      std::vector<Message> messages);
+  void OnTimeout(beast::error_code ec);
+
+  void SendResponse(http::status status, std::string body);
+  void SendError(http::status status, const std::string &message);
+  void OnWrite(bool keep_alive, beast::error_code ec,
+               std::size_t bytes_transferred);
+  void DoClose();
+
+private:
+  beast::tcp_stream stream_;
+  beast::flat_buffer buffer_;
+  http::request<http::string_body> request_;
+  http::response<http::string_body> response_;
+  PollServer &server_;
+
+  net::steady_timer timer_;
+  int64_t poll_room_id_{};
+  uint64_t poll_id_{};
+  bool polling_{};
+};
+
+} // namespace Chat
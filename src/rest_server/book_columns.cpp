@@ -0,0 +1,95 @@
+#include "book_columns.h"
+#include "database.h"
+
+#include <algorithm>
+
+namespace Library {
+
+std::uint32_t BookColumns::findGenre(const std::string &genre) const {
+  auto it = genreLookup.find(genre);
+  return it != genreLookup.end() ? it->second : kNoGenre;
+}
+
+std::uint32_t BookColumns::internGenre(const std::string &genre) {
+  auto [it, inserted] = genreLookup.try_emplace(
+      genre, static_cast<std::uint32_t>(genreNames.size()));
+  if (inserted) {
+    genreNames.push_back(genre);
+  }
+  return it->second;
+}
+
+std::size_t BookColumns::position(int id) const {
+  return static_cast<std::size_t>(
+      std::lower_bound(ids.begin(), ids.end(), id) - ids.begin());
+}
+
+void BookColumns::put(const Book &book) {
+  const std::uint32_t genreId = internGenre(book.genre);
+
+  // Новые книги получают максимальный id, поэтому обычно это push_back
+  std::size_t pos = ids.size();
+  if (!ids.empty() && ids.back() >= book.id) {
+    pos = position(book.id);
+  }
+
+  if (pos < ids.size() && ids[pos] == book.id) {
+    if (genreIds[pos] == kDeleted) {
+      --deleted;
+    }
+  } else {
+    ids.insert(ids.begin() + pos, book.id);
+    years.insert(years.begin() + pos, 0);
+    authorIds.insert(authorIds.begin() + pos, 0);
+    genreIds.insert(genreIds.begin() + pos, 0);
+  }
+
+  years[pos] = book.year;
+  authorIds[pos] = book.authorId;
+  genreIds[pos] = genreId;
+}
+
+void BookColumns::erase(int id) {
+  const std::size_t pos = position(id);
+  if (pos == ids.size() || ids[pos] != id || genreIds[pos] == kDeleted) {
+    return;
+  }
+
+  // Сдвиг всех столбцов на каждое удаление дорог, поэтому строка только
+  // помечается, а уплотнение выполняется, когда помеченных становится много
+  genreIds[pos] = kDeleted;
+  if (++deleted > ids.size() / 2) {
+    compact();
+  }
+}
+
+void BookColumns::compact() {
+  std::size_t out = 0;
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    if (genreIds[i] == kDeleted) {
+      continue;
+    }
+    ids[out] = ids[i];
+    years[out] = years[i];
+    authorIds[out] = authorIds[i];
+    genreIds[out] = genreIds[i];
+    ++out;
+  }
+
+  ids.resize(out);
+  years.resize(out);
+  authorIds.resize(out);
+  genreIds.resize(out);
+  deleted = 0;
+}
+
+std::size_t BookColumns::count(const ColumnFilter &filter) const {
+  std::size_t result = 0;
+  const std::size_t n = ids.size();
+  for (std::size_t i = 0; i < n; ++i) {
+    result += matches(filter, i);
+  }
+  return result;
+}
+
+} // namespace Library
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Library {
+
+class Book;
+
+// Условия отбора книг для сканирования столбцов
+struct ColumnFilter {
+  static constexpr std::uint32_t kAnyGenre =
+      std::numeric_limits<std::uint32_t>::max();
+
+  std::uint32_t genreId = kAnyGenre;
+  int yearFrom = std::numeric_limits<int>::min();
+  int yearTo = std::numeric_limits<int>::max();
+  int authorId = 0; // 0 - любой автор
+};
+
+// Числовые поля книг, разложенные по отдельным массивам (struct of arrays),
+// строки упорядочены по id. Жанры хранятся как малые целые id из словаря,
+// поэтому фильтр по жанру, году и автору - это плотный цикл по массивам без
+// сравнения строк и переходов по узлам дерева
+class BookColumns {
+public:
+  // id жанра в словаре или kNoGenre, если книг такого жанра никогда не было.
+  // Ни одна строка не имеет жанра kNoGenre, так что фильтр по нему пуст
+  static constexpr std::uint32_t kNoGenre = ColumnFilter::kAnyGenre - 2;
+
+  std::uint32_t findGenre(const std::string &genre) const;
+
+  void put(const Book &book);
+  void erase(int id);
+  std::size_t size() const { return ids.size() - deleted; }
+
+  std::size_t count(const ColumnFilter &filter) const;
+
+  // Вызывает fn(id) для подходящих книг по возрастанию id, пока fn
+  // возвращает true
+  template <typename Fn> void scan(const ColumnFilter &filter, Fn &&fn) const {
+    const std::size_t n = ids.size();
+    for (std::size_t i = 0; i < n; ++i) {
+      if (matches(filter, i) && !fn(ids[i])) {
+        return;
+      }
+    }
+  }
+
+private:
+  // Удалённые строки помечаются этим жанром и вычищаются пачкой
+  static constexpr std::uint32_t kDeleted = ColumnFilter::kAnyGenre - 1;
+
+  std::uint32_t internGenre(const std::string &genre);
+  std::size_t position(int id) const;
+  void compact();
+
+  // Без ветвлений внутри: побитовые & вместо && позволяют компилятору
+  // векторизовать цикл в count()
+  bool matches(const ColumnFilter &filter, std::size_t i) const {
+    return (genreIds[i] != kDeleted) &
+           ((filter.genreId == ColumnFilter::kAnyGenre) |
+            (genreIds[i] == filter.genreId)) &
+           (years[i] >= filter.yearFrom) & (years[i] <= filter.yearTo) &
+           ((filter.authorId == 0) | (authorIds[i] == filter.authorId));
+  }
+
+  std::vector<int> ids;
+  std::vector<int> years;
+  std::vector<int> authorIds;
+  std::vector<std::uint32_t> genreIds;
+  std::size_t deleted = 0;
+
+  std::vector<std::string> genreNames;
+  std::unordered_map<std::string, std::uint32_t> genreLookup;
+};
+
+} // namespace Library
@@ -0,0 +1,114 @@
+#include "change_log.h"
+#include "journal.h"
+
+#include <algorithm>
+
+namespace Library {
+
+ChangeLog::ChangeLog(std::size_t capacity)
+    : capacity(std::max<std::size_t>(capacity, 1)), ring(this->capacity),
+      ringLsn(this->capacity) {}
+
+void ChangeLog::reset(std::uint64_t seq) {
+  std::lock_guard<std::mutex> lock(mtx);
+  std::fill(ring.begin(), ring.end(), Change());
+  std::fill(ringLsn.begin(), ringLsn.end(), 0);
+  evictedLsn = 0;
+  firstSeq = seq + 1;
+  lastSeq = seq;
+  visibleSeq = seq;
+}
+
+void ChangeLog::append(const JournalRecord &record, ChangeType type,
+                       std::uint64_t lsn) {
+  Change change;
+  change.type = type;
+  change.version = record.version;
+  switch (record.type) {
+  case JournalRecord::Type::PutAuthor:
+    change.entity = ChangeEntity::Author;
+    change.id = record.author.id;
+    change.author = record.author;
+    break;
+  case JournalRecord::Type::DeleteAuthor:
+    change.entity = ChangeEntity::Author;
+    change.id = record.id;
+    break;
+  case JournalRecord::Type::PutBook:
+    change.entity = ChangeEntity::Book;
+    change.id = record.book.id;
+    change.book = record.book;
+    break;
+  case JournalRecord::Type::DeleteBook:
+    change.entity = ChangeEntity::Book;
+    change.id = record.id;
+    break;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    change.seq = ++lastSeq;
+    if (lastSeq - firstSeq + 1 > capacity) {
+      // Вытесняемое событие занимает тот же слот, что и новое
+      evictedLsn = std::max(evictedLsn, ringLsn[lastSeq % capacity]);
+      ++firstSeq;
+    }
+    ring[lastSeq % capacity] = std::move(change);
+    ringLsn[lastSeq % capacity] = lsn;
+    advanceVisible();
+  }
+  appended.notify_all();
+}
+
+void ChangeLog::markDurable(std::uint64_t lsn) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (lsn <= durableLsn) {
+      return;
+    }
+    durableLsn = lsn;
+    advanceVisible();
+  }
+  appended.notify_all();
+}
+
+void ChangeLog::advanceVisible() {
+  // Вытесненные события проходим разом, когда все они на диске
+  if (visibleSeq + 1 < firstSeq) {
+    if (evictedLsn > durableLsn) {
+      return;
+    }
+    visibleSeq = firstSeq - 1;
+  }
+  while (visibleSeq < lastSeq &&
+         ringLsn[(visibleSeq + 1) % capacity] <= durableLsn) {
+    ++visibleSeq;
+  }
+}
+
+ChangePage ChangeLog::read(std::uint64_t since, std::size_t limit,
+                           std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mtx);
+  if (since == visibleSeq && timeout.count() > 0) {
+    appended.wait_for(lock, timeout, [&] { return visibleSeq != since; });
+  }
+
+  ChangePage page;
+  page.lastSeq = visibleSeq;
+  // Читатели видят только сброшенные на диск события, поэтому since из
+  // будущего означает чужой или испорченный номер, а не потерю при сбое
+  if (since > visibleSeq || since + 1 < firstSeq) {
+    page.resyncRequired = true;
+    return page;
+  }
+
+  const std::uint64_t last =
+      std::min<std::uint64_t>(visibleSeq, since + limit);
+  page.changes.reserve(last - since);
+  for (std::uint64_t seq = since + 1; seq <= last; ++seq) {
+    page.changes.push_back(ring[seq % capacity]);
+  }
+  return page;
+}
+
+} // namespace Library
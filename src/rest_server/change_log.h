@@ -0,0 +1,61 @@
+#pragma once
+
+#include "database.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace Library {
+
+struct JournalRecord;
+
+// Лента изменений в памяти: последние capacity событий в кольцевом буфере.
+// seq событий идут подряд в порядке добавления. Каждое изменение базы
+// получает ровно одну версию и одно событие, поэтому после перезапуска
+// нумерация продолжается с последней версии базы: потребитель, дочитавший
+// ленту до конца, продолжает без полной пересинхронизации.
+// Для этого читателям видны только события, уже сброшенные в журнал на
+// диск: иначе потребитель мог бы прочитать изменение, потерянное при сбое,
+// а после перезапуска тот же seq достался бы другому событию
+class ChangeLog {
+public:
+  explicit ChangeLog(std::size_t capacity);
+
+  // Очищает ленту; следующее событие получит seq lastSeq + 1
+  void reset(std::uint64_t lastSeq);
+  // Вызывается под блокировкой писателя, как и запись в журнал. lsn - номер
+  // записи в журнале; 0 без журнала, тогда событие видно сразу
+  void append(const JournalRecord &record, ChangeType type, std::uint64_t lsn);
+  // Все записи журнала до lsn включительно на диске
+  void markDurable(std::uint64_t lsn);
+
+  // До limit событий с seq > since. Если таких событий ещё нет, ждёт первого
+  // не дольше timeout
+  ChangePage read(std::uint64_t since, std::size_t limit,
+                  std::chrono::milliseconds timeout);
+
+private:
+  // Продвигает visibleSeq по событиям, чьи записи уже на диске
+  void advanceVisible();
+
+  const std::size_t capacity;
+  std::mutex mtx;
+  std::condition_variable appended;
+  // Событие seq хранится в ring[seq % capacity]
+  std::vector<Change> ring;
+  std::vector<std::uint64_t> ringLsn; // LSN события рядом с ним в ring
+  std::uint64_t firstSeq = 1; // Самое старое событие, ещё не вытесненное
+  std::uint64_t lastSeq = 0;
+  // Последнее событие, видимое читателям: все события до него на диске.
+  // LSN и seq в режиме Sharded могут идти в разном порядке, поэтому видимый
+  // префикс ленты растёт только по непрерывной цепочке сброшенных событий
+  std::uint64_t visibleSeq = 0;
+  std::uint64_t durableLsn = 0;
+  std::uint64_t evictedLsn = 0; // Наибольший LSN вытесненных событий
+};
+
+} // namespace Library
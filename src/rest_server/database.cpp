@@ -0,0 +1,1549 @@
+#include "database.h"
+#include "change_log.h"
+#include "journal.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+
+namespace Library {
+
+namespace {
+
+constexpr std::string_view kSnapshotFile = "snapshot.bin";
+constexpr std::string_view kSnapshotMagic = "LIBSNAP1";
+
+// Веса совпадений при поиске: слово названия важнее слова из имени автора,
+// совпадение слова целиком важнее совпадения по префиксу
+constexpr double kTitleMatchWeight = 2.0;
+constexpr double kAuthorMatchWeight = 1.0;
+constexpr double kPrefixMatchFactor = 0.5;
+
+std::string fullName(const Author &author) {
+  return author.firstName + " " + author.lastName;
+}
+
+// Первый год десятилетия, в том числе для годов до нашей эры
+int decadeOf(int year) { return year - ((year % 10) + 10) % 10; }
+
+// Порядок элементов map по ключу
+constexpr auto byKey = [](const auto &a, const auto &b) {
+  return a.first < b.first;
+};
+
+template <typename Iterator>
+using Ranges = std::vector<std::pair<Iterator, Iterator>>;
+
+// Наименьший id, до которого включительно лежат не меньше count строк;
+// rankUpTo(id) - число строк с id не больше заданного. Каждый id встречается
+// один раз, поэтому ранг растёт не больше чем на 1 за id и в найденном id
+// равен count. Около 31 вызова rankUpTo
+template <typename RankUpTo>
+int idAtRank(std::size_t count, RankUpTo &&rankUpTo) {
+  int low = 1;
+  int high = std::numeric_limits<int>::max();
+  while (low < high) {
+    const int mid = low + (high - low) / 2;
+    if (rankUpTo(mid) >= count) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  return low;
+}
+
+// k-way слияние упорядоченных последовательностей (по одной на шард): вызывает
+// fn для элементов в порядке less, пока fn возвращает true. Возвращает false,
+// если обход прервал fn
+template <typename Iterator, typename Less, typename Fn>
+bool mergeSorted(Ranges<Iterator> ranges, Less less, Fn &&fn) {
+  std::erase_if(ranges,
+                [](const auto &range) { return range.first == range.second; });
+
+  if (ranges.size() == 1) {
+    for (auto it = ranges[0].first; it != ranges[0].second; ++it) {
+      if (!fn(*it)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Min-куча по текущим головам последовательностей
+  const auto heapLess = [&](const auto &a, const auto &b) {
+    return less(*b.first, *a.first);
+  };
+  std::make_heap(ranges.begin(), ranges.end(), heapLess);
+  while (!ranges.empty()) {
+    std::pop_heap(ranges.begin(), ranges.end(), heapLess);
+    auto &range = ranges.back();
+    if (!fn(*range.first)) {
+      return false;
+    }
+    if (++range.first == range.second) {
+      ranges.pop_back();
+    } else {
+      std::push_heap(ranges.begin(), ranges.end(), heapLess);
+    }
+  }
+  return true;
+}
+
+// Полные диапазоны контейнера project(state) во всех состояниях
+template <typename StateList, typename Project>
+auto rangesOf(const StateList &states, Project project) {
+  using Container = std::remove_cvref_t<decltype(project(*states[0]))>;
+  Ranges<typename Container::const_iterator> ranges;
+  ranges.reserve(states.size());
+  for (const auto *s : states) {
+    const Container &container = project(*s);
+    ranges.emplace_back(container.begin(), container.end());
+  }
+  return ranges;
+}
+
+// Списки id из индекса index[key] во всех состояниях
+template <typename StateList, typename Index, typename Key>
+Ranges<std::vector<int>::const_iterator>
+indexRanges(const StateList &states, Index index, const Key &key) {
+  Ranges<std::vector<int>::const_iterator> ranges;
+  for (const auto *s : states) {
+    const auto &map = (*s).*index;
+    if (auto it = map.find(key); it != map.end()) {
+      ranges.emplace_back(it->second.begin(), it->second.end());
+    }
+  }
+  return ranges;
+}
+
+// Книги автора могут лежать в любом шарде
+template <typename StateList>
+int totalBookCount(const StateList &states, int authorId) {
+  int count = 0;
+  for (const auto *s : states) {
+    count += s->bookCountForAuthor(authorId);
+  }
+  return count;
+}
+
+} // namespace
+
+Database::Database(ConcurrencyMode mode, std::size_t shardCount,
+                   std::size_t changeLogCapacity)
+    : mode(mode), changeLog(std::make_unique<ChangeLog>(changeLogCapacity)) {
+  if (mode == ConcurrencyMode::Snapshot) {
+    snapshot.store(std::make_shared<const State>());
+  }
+  if (mode == ConcurrencyMode::Sharded) {
+    shards.resize(std::max<std::size_t>(shardCount, 1));
+    for (auto &shard : shards) {
+      shard = std::make_unique<Shard>(shards.size());
+    }
+  }
+}
+
+Database::~Database() = default;
+
+ConcurrencyMode Database::getConcurrencyMode() const { return mode; }
+
+std::size_t Database::shardOf(int key, std::size_t count) {
+  return static_cast<std::size_t>(static_cast<unsigned>(key)) % count;
+}
+
+const Book &Database::bookAt(States states, int id) {
+  return states[shardOf(id, states.size())]->books.at(id);
+}
+
+std::unique_lock<std::mutex> Database::lock(std::mutex &m, LockSite site) {
+  // Без конкуренции обходимся без чтения часов
+  std::unique_lock<std::mutex> guard(m, std::try_to_lock);
+  if (guard.owns_lock()) {
+    lockWaits.record(site, std::chrono::nanoseconds::zero());
+    return guard;
+  }
+
+  const auto started = std::chrono::steady_clock::now();
+  guard.lock();
+  lockWaits.record(site, std::chrono::steady_clock::now() - started);
+  return guard;
+}
+
+LockWaits Database::getLockWaits() const {
+  auto histograms = lockWaits.histograms();
+  return {std::move(histograms[DatabaseLock]),
+          std::move(histograms[ShardLock])};
+}
+
+template <typename Fn> auto Database::read(Fn &&fn) {
+  throwIfJournalFailed();
+  if (mode == ConcurrencyMode::Snapshot) {
+    // Снимок неизменяем и живёт, пока на него есть ссылка
+    std::shared_ptr<const State> current = snapshot.load();
+    return fn(*current);
+  }
+
+  auto guard = lock(mtx, DatabaseLock);
+  return fn(static_cast<const State &>(state));
+}
+
+template <typename Fn> auto Database::write(Fn &&fn) {
+  auto guard = lock(mtx, DatabaseLock);
+  if (mode != ConcurrencyMode::Snapshot) {
+    return fn(state);
+  }
+
+  // Copy-on-write: изменяем копию и публикуем её целиком. Если fn бросит
+  // исключение, читатели так и останутся на прежней версии
+  auto next = std::make_shared<State>(*snapshot.load());
+  if constexpr (std::is_void_v<decltype(fn(*next))>) {
+    fn(*next);
+    snapshot.store(std::move(next));
+  } else {
+    auto result = fn(*next);
+    snapshot.store(std::move(next));
+    return result;
+  }
+}
+
+template <typename Fn> auto Database::readShard(int key, Fn &&fn) {
+  if (mode == ConcurrencyMode::Sharded) {
+    throwIfJournalFailed();
+    Shard &shard = *shards[shardOf(key, shards.size())];
+    auto guard = lock(shard.mtx, ShardLock);
+    return fn(static_cast<const State &>(shard.state));
+  }
+  return read(std::forward<Fn>(fn));
+}
+
+template <typename Fn> auto Database::writeShard(int key, Fn &&fn) {
+  if (mode == ConcurrencyMode::Sharded) {
+    Shard &shard = *shards[shardOf(key, shards.size())];
+    auto guard = lock(shard.mtx, ShardLock);
+    return fn(shard.state);
+  }
+  return write(std::forward<Fn>(fn));
+}
+
+template <typename Fn>
+auto Database::writeShards(int keyA, int keyB, Fn &&fn) {
+  if (mode == ConcurrencyMode::Sharded) {
+    const std::size_t a = shardOf(keyA, shards.size());
+    const std::size_t b = shardOf(keyB, shards.size());
+    if (a == b) {
+      auto guard = lock(shards[a]->mtx, ShardLock);
+      return fn(shards[a]->state, shards[a]->state);
+    }
+
+    // Шарды всегда блокируются по возрастанию номера, как в lockAllShards
+    auto first = lock(shards[std::min(a, b)]->mtx, ShardLock);
+    auto second = lock(shards[std::max(a, b)]->mtx, ShardLock);
+    return fn(shards[a]->state, shards[b]->state);
+  }
+  return write([&](State &s) { return fn(s, s); });
+}
+
+std::vector<std::unique_lock<std::mutex>> Database::lockAllShards() {
+  std::vector<std::unique_lock<std::mutex>> locks;
+  locks.reserve(shards.size());
+  for (auto &shard : shards) {
+    locks.push_back(lock(shard->mtx, ShardLock));
+  }
+  return locks;
+}
+
+template <typename Fn> auto Database::readAll(Fn &&fn) {
+  if (mode == ConcurrencyMode::Sharded) {
+    throwIfJournalFailed();
+    auto locks = lockAllShards();
+    std::vector<const State *> states;
+    states.reserve(shards.size());
+    for (const auto &shard : shards) {
+      states.push_back(&shard->state);
+    }
+    return fn(States(states));
+  }
+  return read([&](const State &s) {
+    const State *single = &s;
+    return fn(States(&single, 1));
+  });
+}
+
+template <typename Fn> auto Database::writeAll(Fn &&fn) {
+  if (mode == ConcurrencyMode::Sharded) {
+    auto locks = lockAllShards();
+    std::vector<State *> states;
+    states.reserve(shards.size());
+    for (auto &shard : shards) {
+      states.push_back(&shard->state);
+    }
+    return fn(MutableStates(states));
+  }
+  return write([&](State &s) {
+    State *single = &s;
+    return fn(MutableStates(&single, 1));
+  });
+}
+
+int Database::reserveAuthorId() {
+  return mode == ConcurrencyMode::Sharded ? counters.nextAuthorId.fetch_add(1)
+                                          : 0;
+}
+
+int Database::reserveBookId() {
+  return mode == ConcurrencyMode::Sharded ? counters.nextBookId.fetch_add(1)
+                                          : 0;
+}
+
+std::uint64_t Database::nextVersion(const State &s) {
+  // В режиме Sharded выданная, но не использованная из-за ошибки журнала
+  // версия остаётся пропуском: её никто не видел
+  if (mode == ConcurrencyMode::Sharded) {
+    return counters.lastVersion.fetch_add(1) + 1;
+  }
+  return s.lastVersion + 1;
+}
+
+void Database::publishVersion(std::atomic<std::uint64_t> &collection,
+                              std::uint64_t version) {
+  // Версия публикуется под блокировкой шарда изменяемой строки и после её
+  // применения. Читатель, увидевший эту версию коллекции, затем блокирует все
+  // шарды и поэтому видит и само изменение: тело ответа бывает только новее
+  // ETag
+  std::uint64_t current = collection.load();
+  while (current < version &&
+         !collection.compare_exchange_weak(current, version)) {
+  }
+}
+
+Versions Database::getVersions() {
+  if (mode == ConcurrencyMode::Sharded) {
+    throwIfJournalFailed();
+    return {counters.authorsVersion.load(), counters.booksVersion.load()};
+  }
+  return read([](const State &s) { return s.versions; });
+}
+
+// ========== ДОЛГОВРЕМЕННОЕ ХРАНЕНИЕ ==========
+
+void Database::open(const std::filesystem::path &dir) {
+  std::lock_guard<std::mutex> lock(mtx);
+  if (journal) {
+    throw std::logic_error("Database is already open");
+  }
+
+  std::filesystem::create_directories(dir);
+
+  auto recovered = std::make_shared<State>();
+  const std::uint64_t firstSegment =
+      loadSnapshot(dir / kSnapshotFile, *recovered);
+  // Дописываем всегда в новый сегмент, чтобы не продолжать после
+  // возможного недописанного хвоста
+  const std::uint64_t nextSegment = Journal::replay(
+      dir, firstSegment,
+      [&](const JournalRecord &record) {
+        recovered->apply(record);
+        hasReplayedRecords = true;
+      });
+
+  // Каждое изменение получило одну версию и одно событие ленты, поэтому
+  // нумерация ленты продолжается с последней версии
+  changeLog->reset(recovered->lastVersion);
+
+  if (mode == ConcurrencyMode::Snapshot) {
+    snapshot.store(std::move(recovered));
+  } else if (mode == ConcurrencyMode::Sharded) {
+    // Раскладываем восстановленные строки по шардам в порядке id
+    auto locks = lockAllShards();
+    for (auto &shard : shards) {
+      shard->state = State(shards.size());
+    }
+    for (const auto &pair : recovered->authors) {
+      shards[shardOf(pair.first, shards.size())]->state.putAuthor(pair.second);
+    }
+    for (const auto &pair : recovered->books) {
+      shards[shardOf(pair.first, shards.size())]->state.putBook(pair.second);
+    }
+
+    counters.nextAuthorId.store(recovered->nextAuthorId);
+    counters.nextBookId.store(recovered->nextBookId);
+    counters.lastVersion.store(recovered->lastVersion);
+    counters.authorsVersion.store(recovered->versions.authors);
+    counters.booksVersion.store(recovered->versions.books);
+  } else {
+    state = std::move(*recovered);
+  }
+
+  dataDir = dir;
+  journal = std::make_unique<Journal>(dir, nextSegment);
+}
+
+bool Database::isDurable() const { return journal != nullptr; }
+
+bool Database::checkpoint() {
+  std::lock_guard<std::mutex> checkpointLock(checkpointMtx);
+
+  std::vector<std::shared_ptr<const State>> copies;
+  Counters snapshotCounters;
+  std::uint64_t segment = 0;
+  {
+    // Копия состояния и смена сегмента под одной блокировкой: всё, что не
+    // попало в снимок, окажется в новом сегменте
+    std::lock_guard<std::mutex> lock(mtx);
+    auto shardLocks = lockAllShards();
+    if (!journal ||
+        (journal->recordsInSegment() == 0 && !hasReplayedRecords)) {
+      return false;
+    }
+    hasReplayedRecords = false;
+
+    if (mode == ConcurrencyMode::Sharded) {
+      for (const auto &shard : shards) {
+        copies.push_back(std::make_shared<const State>(shard->state));
+      }
+      snapshotCounters.nextAuthorId = counters.nextAuthorId.load();
+      snapshotCounters.nextBookId = counters.nextBookId.load();
+      snapshotCounters.lastVersion = counters.lastVersion.load();
+      snapshotCounters.versions = {counters.authorsVersion.load(),
+                                   counters.booksVersion.load()};
+    } else {
+      copies.push_back(mode == ConcurrencyMode::Snapshot
+                           ? snapshot.load()
+                           : std::make_shared<const State>(state));
+      snapshotCounters = countersOf(*copies.front());
+    }
+    segment = journal->rotate();
+  }
+
+  std::vector<const State *> states;
+  for (const auto &copy : copies) {
+    states.push_back(copy.get());
+  }
+
+  try {
+    writeFileDurably(dataDir / kSnapshotFile,
+                     encodeSnapshot(states, snapshotCounters, segment));
+  } catch (...) {
+    // Старые сегменты остались на месте, следующий снимок их учтёт
+    std::lock_guard<std::mutex> lock(mtx);
+    hasReplayedRecords = true;
+    throw;
+  }
+  journal->removeSegmentsBefore(segment);
+  return true;
+}
+
+std::uint64_t Database::journalize(State &s, const JournalRecord &record,
+                                   ChangeType type) {
+  // Сначала журнал: если append бросит исключение, ни строка, ни её версия
+  // не станут видны
+  std::uint64_t lsn = 0;
+  if (journal) {
+    try {
+      lsn = journal->append(record);
+    } catch (const std::runtime_error &e) {
+      throw StorageUnavailable(e.what());
+    }
+  }
+  s.apply(record);
+  if (mode == ConcurrencyMode::Sharded) {
+    const bool authors = record.type == JournalRecord::Type::PutAuthor ||
+                         record.type == JournalRecord::Type::DeleteAuthor;
+    publishVersion(authors ? counters.authorsVersion : counters.booksVersion,
+                   record.version);
+  }
+  changeLog->append(record, type, lsn);
+  return lsn;
+}
+
+void Database::commit(std::uint64_t lsn) {
+  if (journal && lsn != 0) {
+    try {
+      journal->waitDurable(lsn);
+    } catch (const std::runtime_error &e) {
+      // Откатить уже видимые изменения нельзя: на них могли опереться
+      // следующие записи. Как и сервер СУБД при сбое fsync, перестаём
+      // отдавать данные; после перезапуска состояние восстановится с диска
+      journalFailed.store(true);
+      throw StorageUnavailable(e.what());
+    }
+    // Событие ленты становится видимым только теперь
+    changeLog->markDurable(lsn);
+  }
+}
+
+void Database::throwIfJournalFailed() const {
+  if (journalFailed.load(std::memory_order_relaxed)) {
+    throw StorageUnavailable("Database is unavailable after a journal failure");
+  }
+}
+
+Database::Counters Database::countersOf(const State &state) {
+  Counters result;
+  result.nextAuthorId = state.nextAuthorId;
+  result.nextBookId = state.nextBookId;
+  result.lastVersion = state.lastVersion;
+  result.versions = state.versions;
+  return result;
+}
+
+std::string Database::encodeSnapshot(States states, const Counters &counters,
+                                     std::uint64_t segment) {
+  std::string payload;
+  BinaryWriter writer(payload);
+  writer.u64(segment);
+  writer.i32(counters.nextAuthorId);
+  writer.i32(counters.nextBookId);
+  writer.u64(counters.lastVersion);
+  writer.u64(counters.versions.authors);
+  writer.u64(counters.versions.books);
+
+  // Строки пишутся по возрастанию id, так загрузка только дописывает индексы
+  std::size_t authorCount = 0;
+  std::size_t bookCount = 0;
+  for (const auto *s : states) {
+    authorCount += s->authors.size();
+    bookCount += s->books.size();
+  }
+
+  writer.u32(static_cast<std::uint32_t>(authorCount));
+  mergeSorted(rangesOf(states, [](const State &s) -> const auto & {
+                return s.authors;
+              }),
+              byKey, [&](const auto &pair) {
+                writer.author(pair.second);
+                return true;
+              });
+  writer.u32(static_cast<std::uint32_t>(bookCount));
+  mergeSorted(rangesOf(states, [](const State &s) -> const auto & {
+                return s.books;
+              }),
+              byKey, [&](const auto &pair) {
+                writer.book(pair.second);
+                return true;
+              });
+
+  std::string data(kSnapshotMagic);
+  BinaryWriter(data).u32(crc32(payload));
+  data += payload;
+  return data;
+}
+
+std::uint64_t Database::loadSnapshot(const std::filesystem::path &path,
+                                     State &state) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return 0; // Снимка ещё нет: проигрываем весь журнал
+  }
+
+  const std::string data((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+  const std::size_t headerSize = kSnapshotMagic.size() + 4;
+  if (data.size() < headerSize || !data.starts_with(kSnapshotMagic)) {
+    throw std::runtime_error("Snapshot is corrupted: " + path.string());
+  }
+
+  const std::string_view payload =
+      std::string_view(data).substr(headerSize);
+  BinaryReader header(std::string_view(data).substr(kSnapshotMagic.size(), 4));
+  if (header.u32() != crc32(payload)) {
+    throw std::runtime_error("Snapshot is corrupted: " + path.string());
+  }
+
+  BinaryReader reader(payload);
+  const std::uint64_t segment = reader.u64();
+  const int nextAuthorId = reader.i32();
+  const int nextBookId = reader.i32();
+  const std::uint64_t lastVersion = reader.u64();
+  Versions versions;
+  versions.authors = reader.u64();
+  versions.books = reader.u64();
+
+  for (std::uint32_t n = reader.u32(); reader.ok() && n > 0; --n) {
+    state.putAuthor(reader.author());
+  }
+  for (std::uint32_t n = reader.u32(); reader.ok() && n > 0; --n) {
+    state.putBook(reader.book());
+  }
+  if (!reader.ok() || !reader.atEnd()) {
+    throw std::runtime_error("Snapshot is corrupted: " + path.string());
+  }
+
+  state.nextAuthorId = std::max(state.nextAuthorId, nextAuthorId);
+  state.nextBookId = std::max(state.nextBookId, nextBookId);
+  state.lastVersion = lastVersion;
+  state.versions = versions;
+  return segment;
+}
+
+// ========== АВТОРЫ ==========
+
+Author Database::addAuthor(const std::string &firstName,
+                           const std::string &lastName,
+                           const std::string &dob) {
+  std::uint64_t lsn = 0;
+  const int reserved = reserveAuthorId();
+  Author author = writeShard(reserved, [&](State &s) {
+    Author author(reserved != 0 ? reserved : s.nextAuthorId, firstName,
+                  lastName, dob);
+    author.version = nextVersion(s);
+    lsn = journalize(s, JournalRecord::putAuthor(author), ChangeType::Created);
+    return author;
+  });
+  commit(lsn);
+  return author;
+}
+
+Author Database::getAuthor(int id) {
+  return readShard(id, [&](const State &s) {
+    auto it = s.authors.find(id);
+    if (it != s.authors.end()) {
+      return it->second;
+    }
+    return Author(); // Пустой автор если не найден
+  });
+}
+
+bool Database::updateAuthor(int id, const std::string &firstName,
+                            const std::string &lastName,
+                            const std::string &dob) {
+  std::uint64_t lsn = 0;
+  bool updated = writeShard(id, [&](State &s) {
+    if (s.authors.find(id) != s.authors.end()) {
+      Author author(id, firstName, lastName, dob);
+      author.version = nextVersion(s);
+      lsn = journalize(s, JournalRecord::putAuthor(author),
+                       ChangeType::Updated);
+      return true;
+    }
+    return false;
+  });
+  commit(lsn);
+  return updated;
+}
+
+bool Database::deleteAuthor(int id) {
+  std::uint64_t lsn = 0;
+  // Книги автора могут быть в любом шарде, поэтому блокируется вся база
+  bool deleted = writeAll([&](MutableStates states) {
+    // Проверяем, есть ли книги у автора
+    if (totalBookCount(states, id) > 0) {
+      return false; // Нельзя удалить автора с книгами
+    }
+
+    State &s = *states[shardOf(id, states.size())];
+    if (s.authors.find(id) == s.authors.end()) {
+      return false;
+    }
+    lsn = journalize(s, JournalRecord::deleteAuthor(id, nextVersion(s)),
+                     ChangeType::Deleted);
+    return true;
+  });
+  commit(lsn);
+  return deleted;
+}
+
+std::vector<Author> Database::getAllAuthors() {
+  return readAll([&](States states) {
+    std::vector<Author> result;
+    mergeSorted(rangesOf(states, [](const State &s) -> const auto & {
+                  return s.authors;
+                }),
+                byKey, [&](const auto &pair) {
+                  result.push_back(pair.second);
+                  return true;
+                });
+    return result;
+  });
+}
+
+std::vector<std::pair<Author, int>> Database::getAllAuthorsWithBookCounts() {
+  return readAll([&](States states) {
+    std::vector<std::pair<Author, int>> result;
+    mergeSorted(rangesOf(states, [](const State &s) -> const auto & {
+                  return s.authors;
+                }),
+                byKey, [&](const auto &pair) {
+                  result.emplace_back(pair.second,
+                                      totalBookCount(states, pair.first));
+                  return true;
+                });
+    return result;
+  });
+}
+
+std::vector<Author> Database::getAuthors(std::span<const int> ids) {
+  return readAll([&](States states) {
+    std::vector<Author> result;
+    result.reserve(ids.size());
+    for (int id : ids) {
+      const State &s = *states[shardOf(id, states.size())];
+      if (auto it = s.authors.find(id); it != s.authors.end()) {
+        result.push_back(it->second);
+      }
+    }
+    return result;
+  });
+}
+
+std::vector<std::pair<Author, int>>
+Database::getAuthorsWithBookCounts(std::span<const int> ids) {
+  return readAll([&](States states) {
+    std::vector<std::pair<Author, int>> result;
+    result.reserve(ids.size());
+    for (int id : ids) {
+      const State &s = *states[shardOf(id, states.size())];
+      if (auto it = s.authors.find(id); it != s.authors.end()) {
+        result.emplace_back(it->second, totalBookCount(states, id));
+      }
+    }
+    return result;
+  });
+}
+
+int Database::getBookCountForAuthor(int authorId) {
+  return readAll(
+      [&](States states) { return totalBookCount(states, authorId); });
+}
+
+LibraryStats Database::getStats(int topAuthors) {
+  return readAll([&](States states) {
+    LibraryStats stats;
+
+    std::map<std::string, std::size_t> genres;
+    std::map<int, std::size_t> decades;
+    for (const auto *s : states) {
+      stats.authors += s->authors.size();
+      stats.books += s->books.size();
+      for (const auto &[genre, ids] : s->booksByGenre) {
+        genres[genre] += ids.size();
+      }
+      for (const auto &[decade, count] : s->booksByDecade) {
+        decades[decade] += count;
+      }
+    }
+    stats.genres.assign(genres.begin(), genres.end());
+    stats.decades.assign(decades.begin(), decades.end());
+
+    const auto addAuthor = [&](int authorId, int bookCount) {
+      const State &s = *states[shardOf(authorId, states.size())];
+      if (auto it = s.authors.find(authorId); it != s.authors.end()) {
+        stats.topAuthors.emplace_back(it->second, bookCount);
+      }
+    };
+
+    if (states.size() == 1) {
+      for (const auto &[negativeCount, authorId] :
+           states[0]->authorsByBookCount) {
+        if ((int)stats.topAuthors.size() >= topAuthors) {
+          break;
+        }
+        addAuthor(authorId, -negativeCount);
+      }
+      return stats;
+    }
+
+    // Книги автора разнесены по шардам: складываем счётчики шардов
+    std::unordered_map<int, int> counts;
+    for (const auto *s : states) {
+      for (const auto &[authorId, ids] : s->booksByAuthor) {
+        counts[authorId] += static_cast<int>(ids.size());
+      }
+    }
+    std::vector<std::pair<int, int>> ranked;
+    ranked.reserve(counts.size());
+    for (const auto &[authorId, count] : counts) {
+      ranked.emplace_back(-count, authorId);
+    }
+    const std::size_t top =
+        std::min(ranked.size(), static_cast<std::size_t>(std::max(topAuthors, 0)));
+    std::partial_sort(ranked.begin(), ranked.begin() + top, ranked.end());
+    for (std::size_t i = 0; i < top; ++i) {
+      addAuthor(ranked[i].second, -ranked[i].first);
+    }
+    return stats;
+  });
+}
+
+// ========== КНИГИ ==========
+
+Book Database::addBook(const std::string &title, const std::string &genre,
+                       int year, int authorId) {
+  std::uint64_t lsn = 0;
+  const int reserved = reserveBookId();
+  Book book = writeShards(authorId, reserved, [&](State &authorState,
+                                                  State &s) {
+    // Проверяем существование автора
+    if (authorState.authors.find(authorId) == authorState.authors.end()) {
+      throw AuthorNotFound();
+    }
+
+    Book book(reserved != 0 ? reserved : s.nextBookId, title, genre, year,
+              authorId);
+    book.version = nextVersion(s);
+    lsn = journalize(s, JournalRecord::putBook(book), ChangeType::Created);
+    return book;
+  });
+  commit(lsn);
+  return book;
+}
+
+Book Database::getBook(int id) {
+  return readShard(id, [&](const State &s) {
+    auto it = s.books.find(id);
+    if (it != s.books.end()) {
+      return it->second;
+    }
+    return Book(); // Пустая книга если не найдена
+  });
+}
+
+bool Database::updateBook(int id, const std::string &title,
+                          const std::string &genre, int year, int authorId) {
+  std::uint64_t lsn = 0;
+  bool updated = writeShards(authorId, id, [&](State &authorState, State &s) {
+    // Проверяем существование автора
+    if (authorState.authors.find(authorId) == authorState.authors.end()) {
+      return false;
+    }
+
+    auto it = s.books.find(id);
+    if (it != s.books.end()) {
+      Book book(id, title, genre, year, authorId);
+      book.version = nextVersion(s);
+      lsn = journalize(s, JournalRecord::putBook(book), ChangeType::Updated);
+      return true;
+    }
+    return false;
+  });
+  commit(lsn);
+  return updated;
+}
+
+bool Database::deleteBook(int id) {
+  std::uint64_t lsn = 0;
+  bool deleted = writeShard(id, [&](State &s) {
+    auto it = s.books.find(id);
+    if (it == s.books.end()) {
+      return false;
+    }
+
+    lsn = journalize(s, JournalRecord::deleteBook(id, nextVersion(s)),
+                     ChangeType::Deleted);
+    return true;
+  });
+  commit(lsn);
+  return deleted;
+}
+
+std::vector<Book> Database::getAllBooks() {
+  return readAll([&](States states) {
+    std::vector<Book> result;
+    mergeSorted(rangesOf(states, [](const State &s) -> const auto & {
+                  return s.books;
+                }),
+                byKey, [&](const auto &pair) {
+                  result.push_back(pair.second);
+                  return true;
+                });
+    return result;
+  });
+}
+
+std::vector<Book> Database::getBooksByGenre(const std::string &genre) {
+  return readAll([&](States states) {
+    std::vector<Book> result;
+    mergeSorted(indexRanges(states, &State::booksByGenre, genre),
+                std::less<int>(), [&](int id) {
+                  result.push_back(bookAt(states, id));
+                  return true;
+                });
+    return result;
+  });
+}
+
+std::vector<Book> Database::getBooks(std::span<const int> ids) {
+  return readAll([&](States states) {
+    std::vector<Book> result;
+    result.reserve(ids.size());
+    for (int id : ids) {
+      const State &s = *states[shardOf(id, states.size())];
+      if (auto it = s.books.find(id); it != s.books.end()) {
+        result.push_back(it->second);
+      }
+    }
+    return result;
+  });
+}
+
+std::vector<std::pair<Book, Author>>
+Database::getBooksWithAuthors(std::span<const int> ids) {
+  return readAll([&](States states) {
+    std::vector<std::pair<Book, Author>> result;
+    result.reserve(ids.size());
+    for (int id : ids) {
+      const State &s = *states[shardOf(id, states.size())];
+      auto it = s.books.find(id);
+      if (it == s.books.end()) {
+        continue;
+      }
+
+      const int authorId = it->second.authorId;
+      const State &authorState = *states[shardOf(authorId, states.size())];
+      auto authorIt = authorState.authors.find(authorId);
+      result.emplace_back(it->second, authorIt != authorState.authors.end()
+                                          ? authorIt->second
+                                          : Author());
+    }
+    return result;
+  });
+}
+
+BookPage Database::getPaginatedBooks(int page, int limit) {
+  return getFilteredAndPaginatedBooks("", page, limit);
+}
+
+BookPage Database::getFilteredAndPaginatedBooks(const std::string &genre,
+                                                int page, int limit) {
+  BookQuery query;
+  query.genre = genre;
+  return findBooks(query, page, limit);
+}
+
+BookPage Database::getBooksAfter(const std::string &genre, int afterId,
+                                 int limit) {
+  return readAll([&](States states) {
+    BookPage result;
+
+    // Добавляет книгу в страницу; false - страница заполнена
+    const auto take = [&](const Book &book) {
+      if ((int)result.books.size() == limit) {
+        result.hasMore = true;
+        return false;
+      }
+      result.books.push_back(book);
+      return true;
+    };
+
+    if (genre.empty()) {
+      Ranges<BookTable::const_iterator> ranges;
+      for (const auto *s : states) {
+        result.total += s->books.size();
+        ranges.emplace_back(s->books.upper_bound(afterId), s->books.end());
+      }
+      mergeSorted(std::move(ranges), byKey,
+                  [&](const auto &pair) { return take(pair.second); });
+      return result;
+    }
+
+    auto ranges = indexRanges(states, &State::booksByGenre, genre);
+    for (auto &range : ranges) {
+      result.total += range.second - range.first;
+      range.first = std::upper_bound(range.first, range.second, afterId);
+    }
+    mergeSorted(std::move(ranges), std::less<int>(),
+                [&](int id) { return take(bookAt(states, id)); });
+    return result;
+  });
+}
+
+BookPage Database::findBooks(const BookQuery &query, int page, int limit) {
+  if (!query.isSupported()) {
+    throw std::invalid_argument("Unsupported combination of filters and sort");
+  }
+
+  return readAll([&](States states) {
+    BookPage result;
+
+    const bool byGenre = !query.genre.empty();
+    const bool byYear = query.hasYearRange();
+    const bool byAuthor = query.authorId != 0;
+
+    ColumnFilter columnFilter;
+    columnFilter.yearFrom = query.yearFrom;
+    columnFilter.yearTo = query.yearTo;
+    columnFilter.authorId = query.authorId;
+
+    // Годы из диапазона в каждом состоянии
+    using YearIterator = std::map<int, std::vector<int>>::const_iterator;
+    Ranges<YearIterator> yearRanges;
+    for (const auto *s : states) {
+      auto begin = s->booksByYear.lower_bound(query.yearFrom);
+      auto end = query.yearTo < query.yearFrom
+                     ? begin
+                     : s->booksByYear.upper_bound(query.yearTo);
+      yearRanges.emplace_back(begin, end);
+    }
+
+    // Общее число совпадений: по размерам индексов, а при нескольких
+    // условиях сразу - одним проходом по столбцам
+    for (std::size_t i = 0; i < states.size(); ++i) {
+      const State &s = *states[i];
+      if (!byGenre && !byYear && !byAuthor) {
+        result.total += s.books.size();
+      } else if (!byYear && !byAuthor) {
+        if (auto it = s.booksByGenre.find(query.genre);
+            it != s.booksByGenre.end()) {
+          result.total += it->second.size();
+        }
+      } else if (!byGenre && !byYear) {
+        result.total += s.bookCountForAuthor(query.authorId);
+      } else if (!byGenre && !byAuthor) {
+        for (auto it = yearRanges[i].first; it != yearRanges[i].second; ++it) {
+          result.total += it->second.size();
+        }
+      } else {
+        ColumnFilter shardFilter = columnFilter;
+        if (byGenre) {
+          shardFilter.genreId = s.columns.findGenre(query.genre);
+        }
+        result.total += s.columns.count(shardFilter);
+      }
+    }
+
+    std::size_t skip =
+        page > 1 ? static_cast<std::size_t>(page - 1) * limit : 0;
+    if (skip >= result.total) {
+      return result;
+    }
+    result.books.reserve(
+        std::min(result.total - skip, static_cast<std::size_t>(limit)));
+
+    // Условия, которые не покрывает выбранный источник строк
+    bool checkGenre = byGenre;
+    bool checkYear = byYear;
+    bool checkAuthor = byAuthor;
+
+    // Добавляет книгу в страницу; false - страница заполнена
+    const auto take = [&](const Book &book) {
+      if ((checkGenre && book.genre != query.genre) ||
+          (checkYear &&
+           (book.year < query.yearFrom || book.year > query.yearTo)) ||
+          (checkAuthor && book.authorId != query.authorId)) {
+        return true;
+      }
+      if (skip > 0) {
+        --skip;
+        return true;
+      }
+      if ((int)result.books.size() == limit) {
+        result.hasMore = true;
+        return false;
+      }
+      result.books.push_back(book);
+      return true;
+    };
+    // Списки id из индекса; если они целиком удовлетворяют условиям,
+    // пропущенные строки отсчитываются по рангу без обращения к книгам: в
+    // одном списке - сдвигом, в нескольких (по списку на шард) - поиском
+    // последнего пропускаемого id, O(число списков * log n) на страницу
+    const auto takeIds = [&](Ranges<std::vector<int>::const_iterator> ranges) {
+      if (!checkGenre && !checkYear && !checkAuthor) {
+        std::size_t size = 0;
+        for (const auto &range : ranges) {
+          size += range.second - range.first;
+        }
+        if (skip >= size) {
+          skip -= size;
+          return true;
+        }
+        if (ranges.size() == 1) {
+          ranges[0].first += skip;
+        } else if (skip > 0) {
+          const int lastSkipped = idAtRank(skip, [&](int id) {
+            std::size_t rank = 0;
+            for (const auto &range : ranges) {
+              rank += std::upper_bound(range.first, range.second, id) -
+                      range.first;
+            }
+            return rank;
+          });
+          for (auto &range : ranges) {
+            range.first =
+                std::upper_bound(range.first, range.second, lastSkipped);
+          }
+        }
+        skip = 0;
+      }
+      return mergeSorted(std::move(ranges), std::less<int>(),
+                         [&](int id) { return take(bookAt(states, id)); });
+    };
+    // Книги одного года из всех состояний
+    const auto takeYear = [&](int year) {
+      return takeIds(indexRanges(states, &State::booksByYear, year));
+    };
+
+    switch (query.sort) {
+    case BookSort::Year:
+    case BookSort::YearDesc: {
+      checkYear = false;
+      std::vector<int> years;
+      for (const auto &range : yearRanges) {
+        for (auto it = range.first; it != range.second; ++it) {
+          years.push_back(it->first);
+        }
+      }
+      std::sort(years.begin(), years.end());
+      years.erase(std::unique(years.begin(), years.end()), years.end());
+      if (query.sort == BookSort::YearDesc) {
+        std::reverse(years.begin(), years.end());
+      }
+
+      for (int year : years) {
+        if (!takeYear(year)) {
+          break;
+        }
+      }
+      break;
+    }
+    case BookSort::Title:
+      mergeSorted(rangesOf(states, [](const State &s) -> const auto & {
+                    return s.booksByTitle;
+                  }),
+                  std::less<std::pair<std::string, int>>(),
+                  [&](const auto &entry) {
+                    return take(bookAt(states, entry.second));
+                  });
+      break;
+    case BookSort::Id:
+      if (byAuthor) {
+        // Книги автора; прочие условия проверяются по ним построчно
+        checkAuthor = false;
+        takeIds(indexRanges(states, &State::booksByAuthor, query.authorId));
+      } else if (byGenre && !byYear) {
+        checkGenre = false;
+        takeIds(indexRanges(states, &State::booksByGenre, query.genre));
+      } else if (byYear) {
+        // Диапазон лет (и жанр) в порядке id: скан по столбцам каждого шарда
+        // до skip + limit + 1 совпадения
+        checkGenre = false;
+        checkYear = false;
+        if (states.size() == 1) {
+          ColumnFilter filter = columnFilter;
+          if (byGenre) {
+            filter.genreId = states[0]->columns.findGenre(query.genre);
+          }
+          states[0]->columns.scan(filter, [&](int id) {
+            return take(states[0]->books.at(id));
+          });
+          break;
+        }
+
+        // Каждому шарду достаточно отдать skip + limit + 1 подходящих id
+        const std::size_t needed = skip + limit + 1;
+        std::vector<std::vector<int>> matched(states.size());
+        Ranges<std::vector<int>::const_iterator> ranges;
+        for (std::size_t i = 0; i < states.size(); ++i) {
+          ColumnFilter filter = columnFilter;
+          if (byGenre) {
+            filter.genreId = states[i]->columns.findGenre(query.genre);
+          }
+          states[i]->columns.scan(filter, [&](int id) {
+            matched[i].push_back(id);
+            return matched[i].size() < needed;
+          });
+          ranges.emplace_back(matched[i].begin(), matched[i].end());
+        }
+        takeIds(std::move(ranges));
+      } else {
+        // Пропуск без перебора строк: в одном состоянии - k-я строка по
+        // рангу, в шардах - по сумме рангов шардов
+        int lastSkipped = 0;
+        if (states.size() > 1 && skip > 0) {
+          lastSkipped = idAtRank(skip, [&](int id) {
+            std::size_t rank = 0;
+            for (const auto *s : states) {
+              rank += s->books.countUpTo(id);
+            }
+            return rank;
+          });
+        }
+        Ranges<BookTable::const_iterator> ranges;
+        for (const auto *s : states) {
+          ranges.emplace_back(states.size() == 1 ? s->books.nth(skip)
+                                                 : s->books.upper_bound(
+                                                       lastSkipped),
+                              s->books.end());
+        }
+        skip = 0;
+        mergeSorted(std::move(ranges), byKey,
+                    [&](const auto &pair) { return take(pair.second); });
+      }
+      break;
+    }
+    return result;
+  });
+}
+
+SearchResult Database::searchBooks(const std::string &query, int limit) {
+  const std::vector<std::string> terms = tokenize(query);
+
+  return readAll([&](States states) {
+    SearchResult result;
+    if (terms.empty()) {
+      return result;
+    }
+
+    // id книги -> сумма весов по уже обработанным словам запроса
+    std::unordered_map<int, double> scores;
+    for (std::size_t i = 0; i < terms.size(); ++i) {
+      // Лучшее совпадение с текущим словом для каждой книги
+      std::unordered_map<int, double> termScores;
+      const auto match = [&](int bookId, double weight) {
+        double &score = termScores[bookId];
+        score = std::max(score, weight);
+      };
+
+      // Книги автора могут лежать в других шардах, поэтому сначала
+      // собираем подходящих авторов со всех шардов
+      std::vector<std::pair<int, bool>> authors;
+      for (const auto *s : states) {
+        s->titleIndex.forEachPrefixMatch(terms[i], [&](int bookId, bool exact) {
+          match(bookId,
+                kTitleMatchWeight * (exact ? 1.0 : kPrefixMatchFactor));
+        });
+        s->authorNameIndex.forEachPrefixMatch(
+            terms[i],
+            [&](int authorId, bool exact) { authors.emplace_back(authorId, exact); });
+      }
+      for (const auto &[authorId, exact] : authors) {
+        const double weight =
+            kAuthorMatchWeight * (exact ? 1.0 : kPrefixMatchFactor);
+        for (const auto *s : states) {
+          auto booksIt = s->booksByAuthor.find(authorId);
+          if (booksIt == s->booksByAuthor.end()) {
+            continue;
+          }
+          for (int bookId : booksIt->second) {
+            match(bookId, weight);
+          }
+        }
+      }
+
+      if (i == 0) {
+        scores = std::move(termScores);
+        continue;
+      }
+
+      // Оставляем только книги, совпавшие со всеми словами
+      for (auto it = scores.begin(); it != scores.end();) {
+        auto termIt = termScores.find(it->first);
+        if (termIt == termScores.end()) {
+          it = scores.erase(it);
+        } else {
+          it->second += termIt->second;
+          ++it;
+        }
+      }
+      if (scores.empty()) {
+        return result;
+      }
+    }
+
+    std::vector<std::pair<double, int>> ranked;
+    ranked.reserve(scores.size());
+    for (const auto &[bookId, score] : scores) {
+      ranked.emplace_back(score, bookId);
+    }
+
+    // Выше релевантность - раньше; при равенстве по возрастанию id
+    const auto byRelevance = [](const auto &a, const auto &b) {
+      return a.first != b.first ? a.first > b.first : a.second < b.second;
+    };
+    const std::size_t count =
+        std::min(ranked.size(), static_cast<std::size_t>(std::max(limit, 0)));
+    std::partial_sort(ranked.begin(), ranked.begin() + count, ranked.end(),
+                      byRelevance);
+
+    result.total = ranked.size();
+    result.hits.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+      result.hits.push_back(
+          {bookAt(states, ranked[i].second), ranked[i].first});
+    }
+    return result;
+  });
+}
+
+// ========== ПАКЕТНЫЕ ОПЕРАЦИИ ==========
+
+std::vector<int> Database::addAuthors(const std::vector<NewAuthor> &rows) {
+  std::uint64_t lsn = 0;
+  auto ids = writeAll([&](MutableStates states) {
+    std::vector<int> ids;
+    ids.reserve(rows.size());
+    for (const auto &row : rows) {
+      int id = reserveAuthorId();
+      State &s = *states[shardOf(id, states.size())];
+      if (id == 0) {
+        id = s.nextAuthorId;
+      }
+
+      Author author(id, row.firstName, row.lastName, row.dob);
+      author.version = nextVersion(s);
+      lsn = journalize(s, JournalRecord::putAuthor(author),
+                       ChangeType::Created);
+      ids.push_back(author.id);
+    }
+    return ids;
+  });
+  // Один group commit на весь пакет
+  commit(lsn);
+  return ids;
+}
+
+std::vector<int> Database::addBooks(const std::vector<NewBook> &rows) {
+  std::uint64_t lsn = 0;
+  auto ids = writeAll([&](MutableStates states) {
+    std::vector<int> ids;
+    ids.reserve(rows.size());
+    for (const auto &row : rows) {
+      const State &authorState = *states[shardOf(row.authorId, states.size())];
+      if (authorState.authors.find(row.authorId) == authorState.authors.end()) {
+        ids.push_back(0);
+        continue;
+      }
+
+      int id = reserveBookId();
+      State &s = *states[shardOf(id, states.size())];
+      if (id == 0) {
+        id = s.nextBookId;
+      }
+
+      Book book(id, row.title, row.genre, row.year, row.authorId);
+      book.version = nextVersion(s);
+      lsn = journalize(s, JournalRecord::putBook(book), ChangeType::Created);
+      ids.push_back(book.id);
+    }
+    return ids;
+  });
+  commit(lsn);
+  return ids;
+}
+
+std::shared_ptr<const Database::BookTable> Database::getBooksSnapshot() {
+  if (mode == ConcurrencyMode::Snapshot) {
+    throwIfJournalFailed();
+    std::shared_ptr<const State> current = snapshot.load();
+    return std::shared_ptr<const BookTable>(current, &current->books);
+  }
+
+  return readAll([&](States states) {
+    if (states.size() == 1) {
+      return std::make_shared<const BookTable>(states[0]->books);
+    }
+
+    auto books = std::make_shared<BookTable>();
+    mergeSorted(rangesOf(states, [](const State &s) -> const auto & {
+                  return s.books;
+                }),
+                byKey, [&](const auto &pair) {
+                  books->emplace(pair.first, pair.second);
+                  return true;
+                });
+    return std::shared_ptr<const BookTable>(std::move(books));
+  });
+}
+
+// ========== ЛЕНТА ИЗМЕНЕНИЙ ==========
+
+ChangePage Database::getChanges(std::uint64_t since, std::size_t limit,
+                                std::chrono::milliseconds timeout) {
+  return changeLog->read(since, limit, timeout);
+}
+
+// ========== ИНДЕКСЫ ==========
+
+void Database::indexInsert(std::vector<int> &ids, int id) {
+  // Новые книги получают максимальный id, поэтому обычно это push_back
+  if (ids.empty() || ids.back() < id) {
+    ids.push_back(id);
+    return;
+  }
+
+  auto it = std::lower_bound(ids.begin(), ids.end(), id);
+  if (it == ids.end() || *it != id) {
+    ids.insert(it, id);
+  }
+}
+
+void Database::indexErase(std::vector<int> &ids, int id) {
+  auto it = std::lower_bound(ids.begin(), ids.end(), id);
+  if (it != ids.end() && *it == id) {
+    ids.erase(it);
+  }
+}
+
+void Database::State::putAuthor(const Author &author) {
+  auto it = authors.find(author.id);
+  if (it == authors.end()) {
+    authors.emplace(author.id, author);
+    authorNameIndex.add(author.id, fullName(author));
+  } else {
+    if (it->second.firstName != author.firstName ||
+        it->second.lastName != author.lastName) {
+      authorNameIndex.remove(author.id, fullName(it->second));
+      authorNameIndex.add(author.id, fullName(author));
+    }
+    it->second = author;
+  }
+  nextAuthorId = std::max(nextAuthorId, author.id + 1);
+}
+
+void Database::State::putBook(const Book &book) {
+  auto it = books.find(book.id);
+  if (it == books.end()) {
+    books.emplace(book.id, book);
+    addToGenreIndex(book);
+    addToAuthorIndex(book);
+    addToYearIndex(book);
+    booksByTitle.emplace(book.title, book.id);
+    titleIndex.add(book.id, book.title);
+  } else {
+    if (it->second.genre != book.genre) {
+      removeFromGenreIndex(it->second);
+      addToGenreIndex(book);
+    }
+    if (it->second.authorId != book.authorId) {
+      removeFromAuthorIndex(it->second);
+      addToAuthorIndex(book);
+    }
+    if (it->second.year != book.year) {
+      removeFromYearIndex(it->second);
+      addToYearIndex(book);
+    }
+    if (it->second.title != book.title) {
+      booksByTitle.erase({it->second.title, book.id});
+      booksByTitle.emplace(book.title, book.id);
+      titleIndex.remove(book.id, it->second.title);
+      titleIndex.add(book.id, book.title);
+    }
+    it->second = book;
+  }
+  columns.put(book);
+  nextBookId = std::max(nextBookId, book.id + 1);
+}
+
+bool Database::State::eraseAuthor(int id) {
+  auto it = authors.find(id);
+  if (it == authors.end()) {
+    return false;
+  }
+
+  authorNameIndex.remove(id, fullName(it->second));
+  authors.erase(it);
+  return true;
+}
+
+void Database::State::eraseBook(BookTable::iterator it) {
+  removeFromGenreIndex(it->second);
+  removeFromAuthorIndex(it->second);
+  removeFromYearIndex(it->second);
+  booksByTitle.erase({it->second.title, it->first});
+  titleIndex.remove(it->first, it->second.title);
+  columns.erase(it->first);
+  books.erase(it);
+}
+
+void Database::State::apply(const JournalRecord &record) {
+  // В режиме Sharded записи разных шардов попадают в журнал не строго по
+  // возрастанию версий, поэтому версии коллекций берутся как максимум
+  lastVersion = std::max(lastVersion, record.version);
+
+  switch (record.type) {
+  case JournalRecord::Type::PutAuthor:
+    putAuthor(record.author);
+    versions.authors = std::max(versions.authors, record.version);
+    break;
+  case JournalRecord::Type::DeleteAuthor:
+    eraseAuthor(record.id);
+    // id удалённых строк не должны выдаваться повторно
+    nextAuthorId = std::max(nextAuthorId, record.id + 1);
+    versions.authors = std::max(versions.authors, record.version);
+    break;
+  case JournalRecord::Type::PutBook:
+    putBook(record.book);
+    versions.books = std::max(versions.books, record.version);
+    break;
+  case JournalRecord::Type::DeleteBook:
+    if (auto it = books.find(record.id); it != books.end()) {
+      eraseBook(it);
+    }
+    nextBookId = std::max(nextBookId, record.id + 1);
+    versions.books = std::max(versions.books, record.version);
+    break;
+  }
+}
+
+void Database::State::addToGenreIndex(const Book &book) {
+  indexInsert(booksByGenre[book.genre], book.id);
+}
+
+void Database::State::removeFromGenreIndex(const Book &book) {
+  auto it = booksByGenre.find(book.genre);
+  if (it == booksByGenre.end()) {
+    return;
+  }
+
+  indexErase(it->second, book.id);
+  if (it->second.empty()) {
+    booksByGenre.erase(it);
+  }
+}
+
+void Database::State::addToAuthorIndex(const Book &book) {
+  auto &ids = booksByAuthor[book.authorId];
+  const int before = static_cast<int>(ids.size());
+  indexInsert(ids, book.id);
+
+  authorsByBookCount.erase({-before, book.authorId});
+  authorsByBookCount.emplace(-static_cast<int>(ids.size()), book.authorId);
+}
+
+void Database::State::removeFromAuthorIndex(const Book &book) {
+  auto it = booksByAuthor.find(book.authorId);
+  if (it == booksByAuthor.end()) {
+    return;
+  }
+
+  const int before = static_cast<int>(it->second.size());
+  indexErase(it->second, book.id);
+  authorsByBookCount.erase({-before, book.authorId});
+  if (it->second.empty()) {
+    booksByAuthor.erase(it);
+  } else {
+    authorsByBookCount.emplace(-static_cast<int>(it->second.size()),
+                               book.authorId);
+  }
+}
+
+void Database::State::addToYearIndex(const Book &book) {
+  indexInsert(booksByYear[book.year], book.id);
+  ++booksByDecade[decadeOf(book.year)];
+}
+
+void Database::State::removeFromYearIndex(const Book &book) {
+  auto it = booksByYear.find(book.year);
+  if (it == booksByYear.end()) {
+    return;
+  }
+
+  indexErase(it->second, book.id);
+  if (it->second.empty()) {
+    booksByYear.erase(it);
+  }
+
+  auto decadeIt = booksByDecade.find(decadeOf(book.year));
+  if (decadeIt != booksByDecade.end() && --decadeIt->second == 0) {
+    booksByDecade.erase(decadeIt);
+  }
+}
+
+int Database::State::bookCountForAuthor(int authorId) const {
+  auto it = booksByAuthor.find(authorId);
+  return it != booksByAuthor.end() ? static_cast<int>(it->second.size()) : 0;
+}
+
+} // namespace Library
@@ -0,0 +1,476 @@
+#pragma once
+
+#include "book_columns.h"
+#include "id_table.h"
+#include "metrics.h"
+#include "search_index.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <set>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using json = nlohmann::json;
+
+namespace Library {
+
+class ChangeLog;
+class Journal;
+struct JournalRecord;
+
+// Класс для хранения данных об авторе
+class Author {
+public:
+  int id;
+  std::string firstName;
+  std::string lastName;
+  std::string dob; // Дата рождения в формате YYYY-MM-DD
+  std::uint64_t version = 0; // Версия записи, растёт при каждом изменении
+
+  Author() : id(0) {}
+  Author(int id, const std::string &fn, const std::string &ln,
+         const std::string &dob)
+      : id(id), firstName(fn), lastName(ln), dob(dob) {}
+
+  json toJson() const {
+    return {{"id", id},
+            {"firstName", firstName},
+            {"lastName", lastName},
+            {"dob", dob}};
+  }
+
+  json toJsonWithBookCount(int bookCount) const {
+    auto j = toJson();
+    j["booksWritten"] = bookCount;
+    return j;
+  }
+};
+
+// Класс для хранения данных о книге
+class Book {
+public:
+  int id;
+  std::string title;
+  std::string genre;
+  int year;
+  int authorId;
+  std::uint64_t version = 0; // Версия записи, растёт при каждом изменении
+
+  Book() : id(0), year(0), authorId(0) {}
+  Book(int id, const std::string &t, const std::string &g, int y, int aid)
+      : id(id), title(t), genre(g), year(y), authorId(aid) {}
+
+  json toJson() const {
+    return {{"id", id},
+            {"title", title},
+            {"genre", genre},
+            {"year", year},
+            {"authorId", authorId}};
+  }
+};
+
+// Страница выборки книг: сами книги и общее число совпадений
+struct BookPage {
+  std::vector<Book> books;
+  std::size_t total = 0;
+  bool hasMore = false; // Есть ли книги после последней в странице
+};
+
+// Порядок книг в выборке; при равных ключах книги идут по возрастанию id
+enum class BookSort {
+  Id,
+  Year,
+  YearDesc,
+  Title // Побайтово по UTF-8, для кириллицы это алфавитный порядок
+};
+
+// Условия отбора и порядок книг; пустой жанр и authorId = 0 означают "любой"
+struct BookQuery {
+  std::string genre;
+  int yearFrom = std::numeric_limits<int>::min();
+  int yearTo = std::numeric_limits<int>::max();
+  int authorId = 0;
+  BookSort sort = BookSort::Id;
+
+  bool hasYearRange() const {
+    return yearFrom != std::numeric_limits<int>::min() ||
+           yearTo != std::numeric_limits<int>::max();
+  }
+
+  // Сочетания, для которых у findBooks есть индекс: сортировка по названию -
+  // только без фильтров, по году - без жанра и автора
+  bool isSupported() const {
+    switch (sort) {
+    case BookSort::Title:
+      return genre.empty() && authorId == 0 && !hasYearRange();
+    case BookSort::Year:
+    case BookSort::YearDesc:
+      return genre.empty() && authorId == 0;
+    case BookSort::Id:
+      break;
+    }
+    return true;
+  }
+};
+
+// Сводная статистика библиотеки из поддерживаемых при изменениях счётчиков
+struct LibraryStats {
+  std::size_t authors = 0;
+  std::size_t books = 0;
+  std::vector<std::pair<std::string, std::size_t>> genres; // По имени жанра
+  std::vector<std::pair<int, std::size_t>> decades; // Первый год десятилетия
+  std::vector<std::pair<Author, int>> topAuthors;   // По убыванию числа книг
+};
+
+// Результат полнотекстового поиска: книги по убыванию релевантности
+struct SearchHit {
+  Book book;
+  double score = 0;
+};
+
+struct SearchResult {
+  std::vector<SearchHit> hits;
+  std::size_t total = 0; // Всего найдено книг, без учёта limit
+};
+
+// Вид события в ленте изменений
+enum class ChangeType { Created, Updated, Deleted };
+enum class ChangeEntity { Author, Book };
+
+// Событие ленты изменений. Для Created и Updated заполнено новое состояние
+// записи (author или book по entity), для Deleted - только id
+struct Change {
+  std::uint64_t seq = 0;
+  ChangeType type = ChangeType::Created;
+  ChangeEntity entity = ChangeEntity::Author;
+  int id = 0;
+  std::uint64_t version = 0;
+  Author author;
+  Book book;
+};
+
+// Порция ленты изменений
+struct ChangePage {
+  std::vector<Change> changes;
+  std::uint64_t lastSeq = 0; // seq последнего события в ленте
+  // Нужных событий в ленте уже нет: потребитель должен запомнить lastSeq,
+  // заново выгрузить данные целиком и продолжить чтение ленты с lastSeq
+  bool resyncRequired = false;
+};
+
+// Время ожидания блокировок базы. Без конкуренции ожидание нулевое, поэтому
+// доля ненулевых значений показывает, как часто потоки мешают друг другу
+struct LockWaits {
+  LatencyHistogram database; // Database::mtx: режимы Mutex и Snapshot
+  LatencyHistogram shards;   // Мьютексы шардов: режим Sharded
+};
+
+// Данные новых записей для пакетной вставки
+struct NewAuthor {
+  std::string firstName;
+  std::string lastName;
+  std::string dob;
+};
+
+struct NewBook {
+  std::string title;
+  std::string genre;
+  int year = 0;
+  int authorId = 0;
+};
+
+// Версии коллекций: меняются при любом изменении соответствующей таблицы
+struct Versions {
+  std::uint64_t authors = 0;
+  std::uint64_t books = 0;
+};
+
+// Режим синхронизации доступа к базе
+enum class ConcurrencyMode {
+  Mutex,    // Чтение и запись под одним мьютексом
+  Snapshot, // Чтение из неизменяемого снимка, запись публикует новую версию
+  Sharded   // Строки разнесены по шардам по id, у каждого шарда свой мьютекс
+};
+
+// addBook: автора книги нет в базе
+class AuthorNotFound : public std::runtime_error {
+public:
+  AuthorNotFound() : std::runtime_error("Author not found") {}
+};
+
+// Журнал не смог сохранить изменение. Изменения больше не принимаются, а
+// после сбоя fsync база не отдаёт и данные - до перезапуска
+class StorageUnavailable : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// Класс для хранения данных (простая "база данных" в памяти)
+class Database {
+public:
+  using AuthorTable = IdTable<Author>;
+  using BookTable = IdTable<Book>;
+
+  // shardCount используется только в режиме Sharded; changeLogCapacity -
+  // сколько последних событий хранит лента изменений
+  explicit Database(ConcurrencyMode mode = ConcurrencyMode::Mutex,
+                    std::size_t shardCount = 16,
+                    std::size_t changeLogCapacity = 10000);
+  ~Database();
+
+  ConcurrencyMode getConcurrencyMode() const;
+  Versions getVersions();
+
+  // Долговременное хранение: восстанавливает базу из снимка и журнала в
+  // dataDir, после чего каждое изменение подтверждается только после записи
+  // в журнал на диске
+  void open(const std::filesystem::path &dataDir);
+  bool isDurable() const;
+  // Сохраняет снимок базы и удаляет покрытые им сегменты журнала.
+  // Возвращает false, если с прошлого снимка ничего не изменилось
+  bool checkpoint();
+
+  // Авторы
+  Author addAuthor(const std::string &firstName, const std::string &lastName,
+                   const std::string &dob);
+  Author getAuthor(int id);
+  bool updateAuthor(int id, const std::string &firstName,
+                    const std::string &lastName, const std::string &dob);
+  bool deleteAuthor(int id);
+  std::vector<Author> getAllAuthors();
+  // Все авторы вместе с количеством книг, одним снимком под одной блокировкой
+  std::vector<std::pair<Author, int>> getAllAuthorsWithBookCounts();
+  // Авторы по списку id за одно обращение к базе, в порядке ids;
+  // отсутствующие id пропускаются
+  std::vector<Author> getAuthors(std::span<const int> ids);
+  std::vector<std::pair<Author, int>>
+  getAuthorsWithBookCounts(std::span<const int> ids);
+  int getBookCountForAuthor(int authorId);
+  // Статистика без обхода таблиц: счётчики жанров, десятилетий и авторов
+  // обновляются вместе с индексами. topAuthors - сколько авторов вернуть
+  LibraryStats getStats(int topAuthors);
+
+  // Книги
+  Book addBook(const std::string &title, const std::string &genre, int year,
+               int authorId);
+  Book getBook(int id);
+  bool updateBook(int id, const std::string &title, const std::string &genre,
+                  int year, int authorId);
+  bool deleteBook(int id);
+  std::vector<Book> getAllBooks();
+  std::vector<Book> getBooksByGenre(const std::string &genre);
+  // Книги по списку id за одно обращение к базе, в порядке ids;
+  // отсутствующие id пропускаются
+  std::vector<Book> getBooks(std::span<const int> ids);
+  // То же вместе с авторами книг, согласованными с самими книгами
+  std::vector<std::pair<Book, Author>>
+  getBooksWithAuthors(std::span<const int> ids);
+  BookPage getPaginatedBooks(int page, int limit);
+  BookPage getFilteredAndPaginatedBooks(const std::string &genre, int page,
+                                        int limit);
+  // Keyset-пагинация: до limit книг с id > afterId
+  BookPage getBooksAfter(const std::string &genre, int afterId, int limit);
+  // Отбор и сортировка через упорядоченные индексы. Стоимость страницы (s -
+  // число шардов):
+  // - по id без фильтров, по жанру или по автору: O(s * log n + limit),
+  //   пропуск - по рангу в IdTable или в списках индекса;
+  // - по id с автором и другими условиями: O(книг автора);
+  // - по id с диапазоном лет (и жанром): скан столбцов до skip + limit + 1
+  //   совпадения на шард, O(n) в худшем случае;
+  // - по году: O(лет в диапазоне + s * log n + limit);
+  // - по названию: O(skip + limit), booksByTitle читается с начала.
+  // Итог с несколькими условиями считается сканом столбцов, O(n). Сочетания
+  // без индекса (см. BookQuery::isSupported) отклоняются с
+  // std::invalid_argument
+  BookPage findBooks(const BookQuery &query, int page, int limit);
+  // Поиск по словам названия книги и имени автора. Каждое слово запроса
+  // ищется как префикс, книга должна совпасть со всеми словами
+  SearchResult searchBooks(const std::string &query, int limit);
+
+  // Пакетная вставка под одной блокировкой. Для каждой строки возвращается
+  // id новой записи или 0, если строку вставить нельзя (автор не найден)
+  std::vector<int> addAuthors(const std::vector<NewAuthor> &rows);
+  std::vector<int> addBooks(const std::vector<NewBook> &rows);
+  // Согласованный снимок всех книг для выгрузки. В режиме Snapshot данные не
+  // копируются: указатель удерживает опубликованную версию базы
+  std::shared_ptr<const BookTable> getBooksSnapshot();
+
+  // Лента изменений: до limit событий с seq > since. Если новых событий нет,
+  // ждёт первого не дольше timeout (long-poll)
+  ChangePage getChanges(std::uint64_t since, std::size_t limit,
+                        std::chrono::milliseconds timeout = {});
+
+  LockWaits getLockWaits() const;
+
+private:
+  // Всё содержимое базы: таблицы, индексы и счётчики id
+  struct State {
+    // stride - шаг id строк состояния: число шардов в режиме Sharded, иначе 1
+    explicit State(std::size_t stride = 1) : authors(stride), books(stride) {}
+
+    AuthorTable authors;
+    BookTable books;
+    // Жанр -> id книг этого жанра (по возрастанию id)
+    std::unordered_map<std::string, std::vector<int>> booksByGenre;
+    // id автора -> id его книг (по возрастанию id)
+    std::unordered_map<int, std::vector<int>> booksByAuthor;
+    // Год -> id книг этого года (по возрастанию id)
+    std::map<int, std::vector<int>> booksByYear;
+    // Пары (название, id) в порядке сортировки по названию
+    std::set<std::pair<std::string, int>> booksByTitle;
+    // Первый год десятилетия -> число книг
+    std::map<int, std::size_t> booksByDecade;
+    // Пары (-число книг, id автора) для авторов, у которых есть книги
+    std::set<std::pair<int, int>> authorsByBookCount;
+    // Полнотекстовые индексы: слова названий -> id книг,
+    // слова имён авторов -> id авторов
+    InvertedIndex titleIndex;
+    InvertedIndex authorNameIndex;
+    // Числовые поля книг по столбцам для быстрых фильтрующих сканов
+    BookColumns columns;
+    int nextAuthorId = 1;
+    int nextBookId = 1;
+    // Все версии берутся из одного монотонного счётчика
+    std::uint64_t lastVersion = 0;
+    Versions versions;
+
+    // Вставка или замена строки вместе с обновлением индексов
+    void putAuthor(const Author &author);
+    void putBook(const Book &book);
+    bool eraseAuthor(int id);
+    void eraseBook(BookTable::iterator it);
+    // Повтор записи журнала при восстановлении
+    void apply(const JournalRecord &record);
+    void addToGenreIndex(const Book &book);
+    void removeFromGenreIndex(const Book &book);
+    void addToAuthorIndex(const Book &book);
+    void removeFromAuthorIndex(const Book &book);
+    void addToYearIndex(const Book &book);
+    void removeFromYearIndex(const Book &book);
+    int bookCountForAuthor(int authorId) const;
+  };
+
+  // Шард: часть строк со своей блокировкой (режим Sharded)
+  struct Shard {
+    explicit Shard(std::size_t count) : state(count) {}
+
+    std::mutex mtx;
+    State state;
+  };
+
+  // Счётчики, общие для всех шардов (режим Sharded)
+  struct SharedCounters {
+    std::atomic<int> nextAuthorId{1};
+    std::atomic<int> nextBookId{1};
+    std::atomic<std::uint64_t> lastVersion{0};
+    std::atomic<std::uint64_t> authorsVersion{0};
+    std::atomic<std::uint64_t> booksVersion{0};
+  };
+
+  // Счётчики базы, записываемые в снимок
+  struct Counters {
+    int nextAuthorId = 1;
+    int nextBookId = 1;
+    std::uint64_t lastVersion = 0;
+    Versions versions;
+  };
+
+  // Состояния, над которыми выполняется операция: в режиме Sharded это все
+  // шарды по порядку номеров, в остальных режимах - единственное состояние.
+  // Строка с ключом key лежит в states[shardOf(key, states.size())]
+  using States = std::span<const State *const>;
+  using MutableStates = std::span<State *const>;
+
+  static std::size_t shardOf(int key, std::size_t count);
+  static const Book &bookAt(States states, int id);
+
+  // Вторичные индексы: упорядоченные по возрастанию списки id книг
+  static void indexInsert(std::vector<int> &ids, int id);
+  static void indexErase(std::vector<int> &ids, int id);
+
+  enum LockSite { DatabaseLock, ShardLock, LockSiteCount };
+  // Захватывает m и учитывает время ожидания в lockWaits
+  std::unique_lock<std::mutex> lock(std::mutex &m, LockSite site);
+
+  // Выполняют fn над состоянием базы с нужной для режима синхронизацией
+  template <typename Fn> auto read(Fn &&fn);
+  template <typename Fn> auto write(Fn &&fn);
+  // Доступ к одной строке: в режиме Sharded блокируется только её шард
+  template <typename Fn> auto readShard(int key, Fn &&fn);
+  template <typename Fn> auto writeShard(int key, Fn &&fn);
+  // Изменение, затрагивающее две строки (автора и книгу): fn(stateA, stateB)
+  template <typename Fn> auto writeShards(int keyA, int keyB, Fn &&fn);
+  // Операции над всей базой: fn(States) или fn(MutableStates). В режиме
+  // Sharded блокируются все шарды
+  template <typename Fn> auto readAll(Fn &&fn);
+  template <typename Fn> auto writeAll(Fn &&fn);
+  std::vector<std::unique_lock<std::mutex>> lockAllShards();
+
+  // В режиме Sharded id выдаётся до блокировки, так как от него зависит шард;
+  // в остальных режимах возвращается 0 и id берётся из состояния
+  int reserveAuthorId();
+  int reserveBookId();
+  // Версия для следующего изменения s: в режиме Sharded из общего счётчика.
+  // Видимой она становится только в journalize
+  std::uint64_t nextVersion(const State &s);
+  // Поднимает версию коллекции в режиме Sharded до version
+  void publishVersion(std::atomic<std::uint64_t> &collection,
+                      std::uint64_t version);
+
+  // Добавляет запись в журнал, затем применяет её к s и добавляет событие в
+  // ленту изменений (вызывается под блокировкой писателя). Возвращает LSN
+  // записи; 0, если журнал не ведётся
+  std::uint64_t journalize(State &s, const JournalRecord &record,
+                           ChangeType type);
+  // Ждёт, пока запись lsn не окажется на диске (вне блокировки писателя)
+  void commit(std::uint64_t lsn);
+  // Бросает исключение, если журнал отказал (см. journalFailed)
+  void throwIfJournalFailed() const;
+
+  static Counters countersOf(const State &state);
+  static std::string encodeSnapshot(States states, const Counters &counters,
+                                    std::uint64_t segment);
+  // Возвращает номер первого сегмента журнала, не вошедшего в снимок
+  static std::uint64_t loadSnapshot(const std::filesystem::path &path,
+                                    State &state);
+
+private:
+  const ConcurrencyMode mode;
+  // Mutex: защищает state; Snapshot: сериализует только писателей;
+  // Sharded: только открытие базы и снимки
+  std::mutex mtx;
+  State state;
+  // Snapshot: текущая опубликованная версия, читатели берут её без блокировки
+  std::atomic<std::shared_ptr<const State>> snapshot;
+  // Sharded: шарды и общие счётчики; поле state не используется
+  std::vector<std::unique_ptr<Shard>> shards;
+  SharedCounters counters;
+
+  std::filesystem::path dataDir;
+  std::unique_ptr<Journal> journal;
+  std::unique_ptr<ChangeLog> changeLog;
+  // Проигранные при открытии записи, ещё не вошедшие в снимок
+  bool hasReplayedRecords = false;
+  // Запись не дошла до диска, а её строка уже применена: с этого момента
+  // память опережает диск, и база не отдаёт данные до перезапуска
+  std::atomic<bool> journalFailed{false};
+  // Не даёт двум снимкам писаться одновременно
+  std::mutex checkpointMtx;
+  // Ожидание mtx и мьютексов шардов при обращениях к данным, по LockSite
+  LatencyRecorder lockWaits{LockSiteCount};
+};
+
+} // namespace Library
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Library {
+
+// Таблица строк по id. id выдаются подряд и не переиспользуются, поэтому
+// строка лежит в векторе по индексу id / stride: поиск - одно обращение к
+// памяти, обход - проход по непрерывному массиву без узлов дерева. stride > 1
+// используется шардами, в которые попадает каждый stride-й id. Слот удалённой
+// строки остаётся пустым (id 0, ни одна строка такого id не имеет).
+// Дерево Фенвика по занятости слотов даёт ранг строки и k-ю строку по
+// порядку id за O(log n), так что страница без фильтров не перебирает
+// пропускаемые строки. Интерфейс повторяет нужную базе часть std::map<int, T>
+template <typename T> class IdTable {
+public:
+  using value_type = std::pair<int, T>;
+
+  template <bool Const> class Iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = IdTable::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer =
+        std::conditional_t<Const, const value_type *, value_type *>;
+    using reference =
+        std::conditional_t<Const, const value_type &, value_type &>;
+
+    Iterator() = default;
+    // iterator -> const_iterator
+    template <bool OtherConst>
+      requires(Const && !OtherConst)
+    Iterator(const Iterator<OtherConst> &other)
+        : pos(other.pos), last(other.last) {}
+
+    reference operator*() const { return *pos; }
+    pointer operator->() const { return pos; }
+
+    Iterator &operator++() {
+      ++pos;
+      skipEmpty();
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator copy = *this;
+      ++*this;
+      return copy;
+    }
+
+    bool operator==(const Iterator &other) const { return pos == other.pos; }
+
+  private:
+    friend class IdTable;
+    friend class Iterator<true>;
+
+    Iterator(pointer pos, pointer last) : pos(pos), last(last) { skipEmpty(); }
+
+    void skipEmpty() {
+      while (pos != last && pos->first == 0) {
+        ++pos;
+      }
+    }
+
+    pointer pos = nullptr;
+    pointer last = nullptr;
+  };
+
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  explicit IdTable(std::size_t stride = 1) : stride(stride) {}
+
+  iterator begin() { return iterator(slots.data(), endPointer()); }
+  iterator end() { return iterator(endPointer(), endPointer()); }
+  const_iterator begin() const {
+    return const_iterator(slots.data(), endPointer());
+  }
+  const_iterator end() const {
+    return const_iterator(endPointer(), endPointer());
+  }
+
+  std::size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  iterator find(int id) {
+    const std::size_t slot = slotOf(id);
+    return slot < slots.size() && slots[slot].first == id
+               ? iterator(&slots[slot], endPointer())
+               : end();
+  }
+  const_iterator find(int id) const {
+    const std::size_t slot = slotOf(id);
+    return slot < slots.size() && slots[slot].first == id
+               ? const_iterator(&slots[slot], endPointer())
+               : end();
+  }
+
+  T &at(int id) {
+    auto it = find(id);
+    if (it == end()) {
+      throw std::out_of_range("IdTable::at");
+    }
+    return it->second;
+  }
+  const T &at(int id) const {
+    auto it = find(id);
+    if (it == end()) {
+      throw std::out_of_range("IdTable::at");
+    }
+    return it->second;
+  }
+
+  // Число строк с id не больше заданного, O(log n)
+  std::size_t countUpTo(int id) const {
+    if (id <= 0) {
+      return 0;
+    }
+    const std::size_t slot = static_cast<std::size_t>(id) / stride;
+    if (slot >= slots.size()) {
+      return count;
+    }
+    const std::size_t before = prefixCount(slot);
+    return before + (slots[slot].first != 0 && slots[slot].first <= id ? 1 : 0);
+  }
+
+  // Строка с номером k (с нуля) по возрастанию id; end(), если строк не
+  // больше k. O(log n): спуск по дереву Фенвика
+  const_iterator nth(std::size_t k) const {
+    if (k >= count) {
+      return end();
+    }
+    std::size_t pos = 0;
+    std::size_t remaining = k + 1;
+    std::size_t step = 1;
+    while (step * 2 <= fenwick.size()) {
+      step *= 2;
+    }
+    for (; step > 0; step /= 2) {
+      if (pos + step <= fenwick.size() && fenwick[pos + step - 1] < remaining) {
+        pos += step;
+        remaining -= fenwick[pos - 1];
+      }
+    }
+    // pos - число слотов перед искомым
+    return const_iterator(&slots[pos], endPointer());
+  }
+
+  // Первая строка с id больше заданного
+  const_iterator upper_bound(int id) const {
+    const std::size_t slot =
+        id > 0 ? static_cast<std::size_t>(id) / stride : 0;
+    if (slot >= slots.size()) {
+      return end();
+    }
+
+    // В слоте id / stride может лежать и строка с большим id
+    const_iterator it(&slots[slot], endPointer());
+    while (it != end() && it->first <= id) {
+      ++it;
+    }
+    return it;
+  }
+
+  std::pair<iterator, bool> emplace(int id, const T &value) {
+    if (id <= 0) {
+      throw std::invalid_argument("IdTable: id must be positive");
+    }
+
+    const std::size_t slot = slotOf(id);
+    if (slot >= slots.size()) {
+      growFenwick(slot + 1);
+      slots.resize(slot + 1);
+    }
+    if (slots[slot].first != 0) {
+      return {iterator(&slots[slot], endPointer()), false};
+    }
+
+    slots[slot] = value_type(id, value);
+    ++count;
+    addToFenwick(slot, 1);
+    return {iterator(&slots[slot], endPointer()), true};
+  }
+
+  iterator erase(iterator it) {
+    // Пустой T освобождает память строк; сам слот остаётся на месте
+    *it.pos = value_type();
+    --count;
+    addToFenwick(static_cast<std::size_t>(it.pos - slots.data()),
+                 static_cast<std::size_t>(-1));
+    return iterator(it.pos, endPointer());
+  }
+
+private:
+  std::size_t slotOf(int id) const {
+    return id > 0 ? static_cast<std::size_t>(id) / stride : slots.size();
+  }
+
+  value_type *endPointer() { return slots.data() + slots.size(); }
+  const value_type *endPointer() const { return slots.data() + slots.size(); }
+
+  // fenwick[i - 1] - число занятых слотов в (i - lowbit(i), i] (нумерация
+  // слотов с единицы)
+  static std::size_t lowbit(std::size_t i) { return i & (~i + 1); }
+
+  // Число занятых слотов среди первых n
+  std::size_t prefixCount(std::size_t n) const {
+    std::size_t sum = 0;
+    for (std::size_t i = std::min(n, fenwick.size()); i > 0; i -= lowbit(i)) {
+      sum += fenwick[i - 1];
+    }
+    return sum;
+  }
+
+  // delta по модулю 2^N: -1 передаётся как максимальное значение size_t
+  void addToFenwick(std::size_t slot, std::size_t delta) {
+    for (std::size_t i = slot + 1; i <= fenwick.size(); i += lowbit(i)) {
+      fenwick[i - 1] += delta;
+    }
+  }
+
+  // Новые слоты пусты, поэтому узел i покрывает только уже существующие
+  // слоты из своего отрезка
+  void growFenwick(std::size_t size) {
+    const std::size_t old = fenwick.size();
+    fenwick.resize(size);
+    for (std::size_t i = old + 1; i <= size; ++i) {
+      const std::size_t from = i - lowbit(i);
+      fenwick[i - 1] = from < old ? prefixCount(old) - prefixCount(from) : 0;
+    }
+  }
+
+  std::vector<value_type> slots;
+  std::vector<std::size_t> fenwick;
+  std::size_t count = 0;
+  std::size_t stride;
+};
+
+} // namespace Library
@@ -0,0 +1,523 @@
+#include "journal.h"
+
+#include <array>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Library {
+
+namespace {
+
+constexpr std::string_view kSegmentPrefix = "wal-";
+constexpr std::string_view kSegmentSuffix = ".log";
+
+void syncFile(std::FILE *file) {
+  if (std::fflush(file) != 0) {
+    throw std::runtime_error("Journal flush failed");
+  }
+#ifdef _WIN32
+  if (_commit(_fileno(file)) != 0) {
+#else
+  if (fsync(fileno(file)) != 0) {
+#endif
+    throw std::runtime_error("Journal fsync failed");
+  }
+}
+
+// Сбрасывает на диск сам каталог: без этого создание и переименование файлов
+// в нём могут пропасть при отключении питания, даже если данные файлов уже
+// на диске. В Windows каталог так не синхронизировать, там это не нужно
+void syncDirectory(const std::filesystem::path &dir) {
+#ifndef _WIN32
+  const std::string path = dir.empty() ? "." : dir.string();
+  const int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot open directory " + path);
+  }
+  const bool synced = fsync(fd) == 0;
+  ::close(fd);
+  if (!synced) {
+    throw std::runtime_error("Directory fsync failed: " + path);
+  }
+#else
+  (void)dir;
+#endif
+}
+
+std::string readFile(const std::filesystem::path &path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>());
+}
+
+} // namespace
+
+// ========== СЕРИАЛИЗАЦИЯ ==========
+
+void BinaryWriter::u8(std::uint8_t value) {
+  out.push_back(static_cast<char>(value));
+}
+
+void BinaryWriter::u32(std::uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+void BinaryWriter::u64(std::uint64_t value) {
+  for (int i = 0; i < 8; ++i) {
+    out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+void BinaryWriter::str(std::string_view value) {
+  u32(static_cast<std::uint32_t>(value.size()));
+  out.append(value);
+}
+
+void BinaryWriter::author(const Author &author) {
+  i32(author.id);
+  u64(author.version);
+  str(author.firstName);
+  str(author.lastName);
+  str(author.dob);
+}
+
+void BinaryWriter::book(const Book &book) {
+  i32(book.id);
+  u64(book.version);
+  str(book.title);
+  str(book.genre);
+  i32(book.year);
+  i32(book.authorId);
+}
+
+bool BinaryReader::take(std::size_t size) {
+  if (!good || data.size() - pos < size) {
+    good = false;
+    return false;
+  }
+  return true;
+}
+
+std::uint8_t BinaryReader::u8() {
+  if (!take(1)) {
+    return 0;
+  }
+  return static_cast<std::uint8_t>(data[pos++]);
+}
+
+std::uint32_t BinaryReader::u32() {
+  if (!take(4)) {
+    return 0;
+  }
+  std::uint32_t value = 0;
+  for (int i = 0; i < 4; ++i) {
+    value |= static_cast<std::uint32_t>(static_cast<std::uint8_t>(data[pos++]))
+             << (8 * i);
+  }
+  return value;
+}
+
+std::uint64_t BinaryReader::u64() {
+  if (!take(8)) {
+    return 0;
+  }
+  std::uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) {
+    value |= static_cast<std::uint64_t>(static_cast<std::uint8_t>(data[pos++]))
+             << (8 * i);
+  }
+  return value;
+}
+
+std::string BinaryReader::str() {
+  std::uint32_t size = u32();
+  if (!take(size)) {
+    return {};
+  }
+  std::string value(data.substr(pos, size));
+  pos += size;
+  return value;
+}
+
+Author BinaryReader::author() {
+  Author author;
+  author.id = i32();
+  author.version = u64();
+  author.firstName = str();
+  author.lastName = str();
+  author.dob = str();
+  return author;
+}
+
+Book BinaryReader::book() {
+  Book book;
+  book.id = i32();
+  book.version = u64();
+  book.title = str();
+  book.genre = str();
+  book.year = i32();
+  book.authorId = i32();
+  return book;
+}
+
+std::uint32_t crc32(std::string_view data) {
+  static const auto table = [] {
+    std::array<std::uint32_t, 256> t{};
+    for (std::uint32_t i = 0; i < 256; ++i) {
+      std::uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+
+  std::uint32_t crc = 0xFFFFFFFFu;
+  for (char ch : data) {
+    crc = table[(crc ^ static_cast<std::uint8_t>(ch)) & 0xFF] ^ (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFFu;
+}
+
+void writeFileDurably(const std::filesystem::path &path,
+                      const std::string &data) {
+  std::filesystem::path tmp = path;
+  tmp += ".tmp";
+
+  std::FILE *file = std::fopen(tmp.string().c_str(), "wb");
+  if (file == nullptr) {
+    throw std::runtime_error("Cannot create " + tmp.string());
+  }
+
+  bool written = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+  try {
+    syncFile(file);
+  } catch (...) {
+    written = false;
+  }
+  std::fclose(file);
+
+  if (!written) {
+    throw std::runtime_error("Cannot write " + tmp.string());
+  }
+  std::filesystem::rename(tmp, path);
+  // Переименование должно пережить сбой раньше, чем вызывающий удалит
+  // то, что новый файл заменяет (например, покрытые снимком сегменты)
+  syncDirectory(path.parent_path());
+}
+
+// ========== ЗАПИСИ ЖУРНАЛА ==========
+
+JournalRecord JournalRecord::putAuthor(const Author &author) {
+  JournalRecord record;
+  record.type = Type::PutAuthor;
+  record.version = author.version;
+  record.author = author;
+  return record;
+}
+
+JournalRecord JournalRecord::putBook(const Book &book) {
+  JournalRecord record;
+  record.type = Type::PutBook;
+  record.version = book.version;
+  record.book = book;
+  return record;
+}
+
+JournalRecord JournalRecord::deleteAuthor(int id, std::uint64_t version) {
+  JournalRecord record;
+  record.type = Type::DeleteAuthor;
+  record.version = version;
+  record.id = id;
+  return record;
+}
+
+JournalRecord JournalRecord::deleteBook(int id, std::uint64_t version) {
+  JournalRecord record;
+  record.type = Type::DeleteBook;
+  record.version = version;
+  record.id = id;
+  return record;
+}
+
+namespace {
+
+// Формат записи в сегменте: [u32 длина][u32 crc32][тело]
+void encodeRecord(std::string &out, const JournalRecord &record) {
+  std::string payload;
+  BinaryWriter writer(payload);
+  writer.u8(static_cast<std::uint8_t>(record.type));
+  writer.u64(record.version);
+  switch (record.type) {
+  case JournalRecord::Type::PutAuthor:
+    writer.author(record.author);
+    break;
+  case JournalRecord::Type::PutBook:
+    writer.book(record.book);
+    break;
+  case JournalRecord::Type::DeleteAuthor:
+  case JournalRecord::Type::DeleteBook:
+    writer.i32(record.id);
+    break;
+  }
+
+  BinaryWriter header(out);
+  header.u32(static_cast<std::uint32_t>(payload.size()));
+  header.u32(crc32(payload));
+  out += payload;
+}
+
+bool decodeRecord(std::string_view payload, JournalRecord &record) {
+  BinaryReader reader(payload);
+  record.type = static_cast<JournalRecord::Type>(reader.u8());
+  record.version = reader.u64();
+  switch (record.type) {
+  case JournalRecord::Type::PutAuthor:
+    record.author = reader.author();
+    break;
+  case JournalRecord::Type::PutBook:
+    record.book = reader.book();
+    break;
+  case JournalRecord::Type::DeleteAuthor:
+  case JournalRecord::Type::DeleteBook:
+    record.id = reader.i32();
+    break;
+  default:
+    return false;
+  }
+  return reader.ok() && reader.atEnd();
+}
+
+// Номера сегментов в каталоге, по возрастанию
+std::map<std::uint64_t, std::filesystem::path>
+listSegments(const std::filesystem::path &dir) {
+  std::map<std::uint64_t, std::filesystem::path> segments;
+  std::error_code ec;
+  for (const auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+    const std::string name = entry.path().filename().string();
+    if (name.size() <= kSegmentPrefix.size() + kSegmentSuffix.size() ||
+        !name.starts_with(kSegmentPrefix) || !name.ends_with(kSegmentSuffix)) {
+      continue;
+    }
+
+    const std::string number = name.substr(
+        kSegmentPrefix.size(),
+        name.size() - kSegmentPrefix.size() - kSegmentSuffix.size());
+    try {
+      segments[std::stoull(number)] = entry.path();
+    } catch (const std::exception &) {
+      // Посторонний файл с похожим именем
+    }
+  }
+  return segments;
+}
+
+} // namespace
+
+// ========== ЖУРНАЛ ==========
+
+Journal::Journal(std::filesystem::path dir, std::uint64_t segment)
+    : dir(std::move(dir)), segment(segment) {
+  std::filesystem::create_directories(this->dir);
+  openSegment();
+}
+
+Journal::~Journal() {
+  std::unique_lock<std::mutex> lock(mtx);
+  cv.wait(lock, [this] { return !flushing; });
+  if (file != nullptr) {
+    if (!buffer.empty() && !failed) {
+      std::fwrite(buffer.data(), 1, buffer.size(), file);
+    }
+    std::fclose(file);
+  }
+}
+
+std::filesystem::path Journal::segmentPath(const std::filesystem::path &dir,
+                                           std::uint64_t segment) {
+  std::string number = std::to_string(segment);
+  if (number.size() < 8) {
+    number.insert(0, 8 - number.size(), '0');
+  }
+  return dir / (std::string(kSegmentPrefix) + number +
+                std::string(kSegmentSuffix));
+}
+
+void Journal::openSegment() {
+  const auto path = segmentPath(dir, segment);
+  file = std::fopen(path.string().c_str(), "ab");
+  if (file == nullptr) {
+    throw std::runtime_error("Cannot open journal segment " + path.string());
+  }
+  // Иначе записи, подтверждённые fsync файла, могут остаться в сегменте,
+  // которого после сбоя нет в каталоге
+  syncDirectory(dir);
+  segmentRecords = 0;
+}
+
+std::uint64_t Journal::append(const JournalRecord &record) {
+  std::lock_guard<std::mutex> lock(mtx);
+  throwIfFailed();
+  encodeRecord(buffer, record);
+  ++segmentRecords;
+  return ++lastLsn;
+}
+
+void Journal::flushBatch(std::FILE *out, const std::string &batch) {
+  if (std::fwrite(batch.data(), 1, batch.size(), out) != batch.size()) {
+    throw std::runtime_error("Journal write failed");
+  }
+  syncFile(out);
+}
+
+void Journal::throwIfFailed() const {
+  if (failed) {
+    throw std::runtime_error("Journal is unavailable after a write failure");
+  }
+}
+
+void Journal::waitDurable(std::uint64_t lsn) {
+  std::unique_lock<std::mutex> lock(mtx);
+  while (durableLsn < lsn) {
+    throwIfFailed();
+    if (flushing) {
+      // Пачку уже пишет другой поток; возможно, наша запись в неё попала
+      cv.wait(lock);
+      continue;
+    }
+
+    // Становимся лидером и сбрасываем всё накопленное одним fsync
+    flushing = true;
+    std::string batch;
+    batch.swap(buffer);
+    const std::uint64_t batchLsn = lastLsn;
+    std::FILE *out = file;
+
+    lock.unlock();
+    try {
+      flushBatch(out, batch);
+    } catch (...) {
+      // Пачка могла попасть в файл частично; дописывать после неё нельзя,
+      // а durableLsn не должен пройти мимо потерянных записей
+      lock.lock();
+      flushing = false;
+      failed = true;
+      cv.notify_all();
+      throw;
+    }
+    lock.lock();
+
+    flushing = false;
+    durableLsn = batchLsn;
+    cv.notify_all();
+  }
+}
+
+std::uint64_t Journal::rotate() {
+  std::unique_lock<std::mutex> lock(mtx);
+  cv.wait(lock, [this] { return !flushing; });
+  throwIfFailed();
+
+  try {
+    flushBatch(file, buffer);
+  } catch (...) {
+    failed = true;
+    cv.notify_all();
+    throw;
+  }
+  buffer.clear();
+  durableLsn = lastLsn;
+  cv.notify_all();
+
+  std::fclose(file);
+  file = nullptr;
+  ++segment;
+  openSegment();
+  return segment;
+}
+
+std::uint64_t Journal::recordsInSegment() {
+  std::lock_guard<std::mutex> lock(mtx);
+  return segmentRecords;
+}
+
+void Journal::removeSegmentsBefore(std::uint64_t firstKept) {
+  for (const auto &[number, path] : listSegments(dir)) {
+    if (number >= firstKept) {
+      break;
+    }
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+  }
+}
+
+std::uint64_t
+Journal::replay(const std::filesystem::path &dir, std::uint64_t fromSegment,
+                const std::function<void(const JournalRecord &)> &apply) {
+  std::uint64_t nextSegment = fromSegment;
+  const auto segments = listSegments(dir);
+
+  for (auto it = segments.lower_bound(fromSegment); it != segments.end();
+       ++it) {
+    const auto &[number, path] = *it;
+    const bool last = std::next(it) == segments.end();
+    nextSegment = number + 1;
+
+    const std::string data = readFile(path);
+    std::size_t offset = 0;
+    while (offset < data.size()) {
+      const std::string_view rest = std::string_view(data).substr(offset);
+      // Недописанной может быть только последняя запись файла: заголовок
+      // или тело обрезаны, либо тело дописано не полностью и не сходится CRC
+      bool torn = rest.size() < 8;
+      bool corrupted = false;
+      JournalRecord record;
+      if (!torn) {
+        BinaryReader header(rest.substr(0, 8));
+        const std::uint32_t size = header.u32();
+        const std::uint32_t checksum = header.u32();
+        if (rest.size() - 8 < size) {
+          torn = true;
+        } else {
+          const std::string_view payload = rest.substr(8, size);
+          if (crc32(payload) != checksum || !decodeRecord(payload, record)) {
+            torn = rest.size() - 8 == size;
+            corrupted = !torn;
+          } else {
+            apply(record);
+            offset += 8 + size;
+            continue;
+          }
+        }
+      }
+
+      // Хвост последнего сегмента - след сбоя во время записи; его обрезаем,
+      // чтобы при следующем запуске сегмент не считался испорченным. Любая
+      // другая плохая запись означает потерю подтверждённых данных
+      if (torn && last && !corrupted) {
+        std::filesystem::resize_file(path, offset);
+        break;
+      }
+      throw std::runtime_error("Journal segment " + path.string() +
+                               " is corrupted at offset " +
+                               std::to_string(offset));
+    }
+  }
+
+  return nextSegment;
+}
+
+} // namespace Library
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "database.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace Library {
+
+// Компактная бинарная сериализация (little-endian) для журнала и снимков
+class BinaryWriter {
+public:
+  explicit BinaryWriter(std::string &out) : out(out) {}
+
+  void u8(std::uint8_t value);
+  void u32(std::uint32_t value);
+  void u64(std::uint64_t value);
+  void i32(std::int32_t value) { u32(static_cast<std::uint32_t>(value)); }
+  void str(std::string_view value);
+
+  void author(const Author &author);
+  void book(const Book &book);
+
+private:
+  std::string &out;
+};
+
+// Чтение с проверкой границ: после первой ошибки ok() возвращает false
+class BinaryReader {
+public:
+  explicit BinaryReader(std::string_view data) : data(data) {}
+
+  std::uint8_t u8();
+  std::uint32_t u32();
+  std::uint64_t u64();
+  std::int32_t i32() { return static_cast<std::int32_t>(u32()); }
+  std::string str();
+
+  Author author();
+  Book book();
+
+  bool ok() const { return good; }
+  bool atEnd() const { return pos == data.size(); }
+
+private:
+  bool take(std::size_t size);
+
+  std::string_view data;
+  std::size_t pos = 0;
+  bool good = true;
+};
+
+std::uint32_t crc32(std::string_view data);
+
+// Записывает файл целиком и сбрасывает его на диск; затем атомарно заменяет
+// им path и сбрасывает каталог, так что при сбое остаётся либо старая, либо
+// новая версия, а после возврата - только новая
+void writeFileDurably(const std::filesystem::path &path,
+                      const std::string &data);
+
+// Одна запись журнала: полное новое состояние строки или удаление
+struct JournalRecord {
+  enum class Type : std::uint8_t {
+    PutAuthor = 1,
+    DeleteAuthor = 2,
+    PutBook = 3,
+    DeleteBook = 4
+  };
+
+  Type type = Type::PutAuthor;
+  std::uint64_t version = 0; // Версия базы после применения записи
+  int id = 0;                // Для удалений
+  Author author;             // Для PutAuthor
+  Book book;                 // Для PutBook
+
+  static JournalRecord putAuthor(const Author &author);
+  static JournalRecord putBook(const Book &book);
+  static JournalRecord deleteAuthor(int id, std::uint64_t version);
+  static JournalRecord deleteBook(int id, std::uint64_t version);
+};
+
+// Журнал упреждающей записи (WAL) из нумерованных сегментов wal-N.log.
+// Записи копятся в буфере, а fsync выполняет один поток-лидер сразу для всех
+// ожидающих (group commit)
+class Journal {
+public:
+  // Открывает новый сегмент с номером segment для дозаписи
+  Journal(std::filesystem::path dir, std::uint64_t segment);
+  ~Journal();
+
+  Journal(const Journal &) = delete;
+  Journal &operator=(const Journal &) = delete;
+
+  // Добавляет запись в буфер и возвращает её порядковый номер (LSN)
+  std::uint64_t append(const JournalRecord &record);
+  // Блокирует до тех пор, пока запись lsn не окажется на диске. После первой
+  // ошибки записи или fsync журнал отказывает: этот и все следующие вызовы
+  // append, waitDurable и rotate бросают исключение, потому что неизвестно,
+  // какая часть пачки попала на диск
+  void waitDurable(std::uint64_t lsn);
+
+  // Сбрасывает буфер, закрывает текущий сегмент и начинает следующий.
+  // Возвращает номер нового сегмента
+  std::uint64_t rotate();
+  std::uint64_t recordsInSegment();
+
+  // Удаляет сегменты, полностью покрытые снимком
+  void removeSegmentsBefore(std::uint64_t segment);
+
+  // Проигрывает записи всех сегментов с номером >= fromSegment по порядку.
+  // Недописанный хвост последнего сегмента (сбой во время записи)
+  // обрезается; испорченная запись в любом другом месте - исключение.
+  // Возвращает номер, с которого можно начинать новый сегмент
+  static std::uint64_t
+  replay(const std::filesystem::path &dir, std::uint64_t fromSegment,
+         const std::function<void(const JournalRecord &)> &apply);
+
+  static std::filesystem::path segmentPath(const std::filesystem::path &dir,
+                                           std::uint64_t segment);
+
+private:
+  void openSegment();
+  void flushBatch(std::FILE *out, const std::string &batch);
+  void throwIfFailed() const;
+
+  const std::filesystem::path dir;
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::FILE *file = nullptr;
+  std::uint64_t segment;
+  std::uint64_t segmentRecords = 0;
+
+  std::string buffer;          // Записи, ещё не переданные на диск
+  std::uint64_t lastLsn = 0;   // Последний выданный LSN
+  std::uint64_t durableLsn = 0; // Последний LSN, сброшенный на диск
+  bool flushing = false;       // Лидер сейчас пишет пачку на диск
+  bool failed = false;         // Запись или fsync не удались
+};
+
+} // namespace Library
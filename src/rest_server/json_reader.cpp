@@ -0,0 +1,166 @@
+#include "json_reader.h"
+
+#include <algorithm>
+#include <limits>
+#include <span>
+#include <string>
+
+namespace Library {
+
+namespace {
+
+// Ожидаемое поле объекта: строка (text) или целое (number)
+struct Field {
+  std::string_view name;
+  std::string *text = nullptr;
+  int *number = nullptr;
+  bool seen = false;
+};
+
+// Обработчик событий json::sax_parse для плоского объекта с полями fields.
+// Возврат false из обработчика сразу останавливает разбор
+class FieldReader {
+public:
+  explicit FieldReader(std::span<Field> fields) : fields(fields) {}
+
+  bool syntaxError = false;
+
+  bool null() { return scalar(); }
+  // Булево значение в числовом поле - 0 или 1, как у json::get<int>()
+  bool boolean(bool value) {
+    return expects(&Field::number) ? assign(value ? 1 : 0) : scalar();
+  }
+  bool number_float(json::number_float_t, const json::string_t &) {
+    return scalar();
+  }
+  bool binary(json::binary_t &) { return scalar(); }
+
+  bool number_integer(json::number_integer_t value) {
+    if (!expects(&Field::number)) {
+      return scalar();
+    }
+    if (value < std::numeric_limits<int>::min() ||
+        value > std::numeric_limits<int>::max()) {
+      return false;
+    }
+    return assign(static_cast<int>(value));
+  }
+
+  bool number_unsigned(json::number_unsigned_t value) {
+    if (!expects(&Field::number)) {
+      return scalar();
+    }
+    if (value > static_cast<json::number_unsigned_t>(
+                    std::numeric_limits<int>::max())) {
+      return false;
+    }
+    return assign(static_cast<int>(value));
+  }
+
+  bool string(json::string_t &value) {
+    if (!expects(&Field::text)) {
+      return scalar();
+    }
+    // Обмен вместо копии: буфер лексера очищается перед следующим токеном,
+    // а прежняя ёмкость строки поля достаётся ему
+    current->text->swap(value);
+    current->seen = true;
+    current = nullptr;
+    return true;
+  }
+
+  bool start_object(std::size_t) { return nested(); }
+  bool start_array(std::size_t) { return depth > 0 && nested(); }
+  bool end_object() { return leave(); }
+  bool end_array() { return leave(); }
+
+  bool key(json::string_t &name) {
+    if (depth == 1) {
+      auto it = std::find_if(fields.begin(), fields.end(),
+                             [&](const Field &f) { return f.name == name; });
+      current = it != fields.end() ? &*it : nullptr;
+    }
+    return true;
+  }
+
+  bool parse_error(std::size_t, const std::string &,
+                   const nlohmann::detail::exception &) {
+    syntaxError = true;
+    return false;
+  }
+
+  bool complete() const {
+    return std::all_of(fields.begin(), fields.end(),
+                       [](const Field &f) { return f.seen; });
+  }
+
+private:
+  // Значение ожидаемого поля нужного вида
+  bool expects(auto Field::*member) const {
+    return depth == 1 && current != nullptr && current->*member != nullptr;
+  }
+
+  bool assign(int value) {
+    *current->number = value;
+    current->seen = true;
+    current = nullptr;
+    return true;
+  }
+
+  // Скаляр верхнего уровня - не объект; скаляр вместо ожидаемого поля -
+  // неверный тип; прочие пропускаются
+  bool scalar() {
+    if (depth == 0 || (depth == 1 && current != nullptr)) {
+      return false;
+    }
+    return true;
+  }
+
+  // Объект верхнего уровня или вложенное значение неизвестного поля
+  bool nested() {
+    if (depth == 1 && current != nullptr) {
+      return false;
+    }
+    ++depth;
+    return true;
+  }
+
+  bool leave() {
+    if (--depth == 1) {
+      current = nullptr;
+    }
+    return true;
+  }
+
+  std::span<Field> fields;
+  Field *current = nullptr; // Поле, чьё значение сейчас разбирается
+  std::size_t depth = 0;
+};
+
+DecodeStatus decodeFields(std::string_view text, std::span<Field> fields) {
+  FieldReader reader(fields);
+  if (json::sax_parse(text.begin(), text.end(), &reader)) {
+    return reader.complete() ? DecodeStatus::Ok : DecodeStatus::MissingFields;
+  }
+  return reader.syntaxError ? DecodeStatus::InvalidJson
+                            : DecodeStatus::MissingFields;
+}
+
+} // namespace
+
+DecodeStatus decodeJson(std::string_view text, NewBook &book) {
+  Field fields[] = {{"title", &book.title},
+                    {"genre", &book.genre},
+                    {"year", nullptr, &book.year},
+                    {"authorId", nullptr, &book.authorId}};
+  return decodeFields(text, fields);
+}
+
+DecodeStatus decodeJson(std::string_view text, NewAuthor &author) {
+  Field fields[] = {{"firstName", &author.firstName},
+                    {"lastName", &author.lastName},
+                    {"dob", &author.dob}};
+  return decodeFields(text, fields);
+}
+
+} // namespace Library
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "database.h"
+
+#include <string_view>
+
+namespace Library {
+
+// Разбор тела запроса без json DOM: один проход SAX-парсера nlohmann, который
+// пишет известные поля прямо в структуру и останавливается на первом поле
+// неверного типа. Неизвестные поля (в том числе вложенные) пропускаются
+enum class DecodeStatus {
+  Ok,
+  InvalidJson,  // Синтаксическая ошибка
+  MissingFields // Не объект, обязательного поля нет или у него другой тип
+};
+
+// title, genre - строки; year, authorId - целые (true и false читаются как 1
+// и 0, как у json::get<int>())
+DecodeStatus decodeJson(std::string_view text, NewBook &book);
+// firstName, lastName, dob - строки
+DecodeStatus decodeJson(std::string_view text, NewAuthor &author);
+
+} // namespace Library
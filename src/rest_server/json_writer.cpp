@@ -0,0 +1,133 @@
+#include "json_writer.h"
+
+#include <charconv>
+#include <cmath>
+#include <string_view>
+
+namespace Library {
+
+void appendJsonString(std::string &out, std::string_view value) {
+  static constexpr char hex[] = "0123456789abcdef";
+
+  out.push_back('"');
+  for (char c : value) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\b':
+      out += "\\b";
+      break;
+    case '\f':
+      out += "\\f";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        out += "\\u00";
+        out.push_back(hex[(c >> 4) & 0x0F]);
+        out.push_back(hex[c & 0x0F]);
+      } else {
+        // UTF-8 (в том числе кириллица) пишется как есть
+        out.push_back(c);
+      }
+    }
+  }
+  out.push_back('"');
+}
+
+void appendJsonInt(std::string &out, long long value) {
+  char buf[24];
+  auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+  out.append(buf, end);
+}
+
+void appendJsonDouble(std::string &out, double value) {
+  if (!std::isfinite(value)) {
+    out += "null";
+    return;
+  }
+
+  char buf[32];
+  auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+  std::string_view text(buf, end - buf);
+  out += text;
+  if (text.find_first_of(".e") == std::string_view::npos) {
+    out += ".0";
+  }
+}
+
+void appendJson(std::string &out, const Book &book) {
+  out += "{\"authorId\":";
+  appendJsonInt(out, book.authorId);
+  out += ",\"genre\":";
+  appendJsonString(out, book.genre);
+  out += ",\"id\":";
+  appendJsonInt(out, book.id);
+  out += ",\"title\":";
+  appendJsonString(out, book.title);
+  out += ",\"year\":";
+  appendJsonInt(out, book.year);
+  out.push_back('}');
+}
+
+void appendJson(std::string &out, const Author &author) {
+  out += "{\"dob\":";
+  appendJsonString(out, author.dob);
+  out += ",\"firstName\":";
+  appendJsonString(out, author.firstName);
+  out += ",\"id\":";
+  appendJsonInt(out, author.id);
+  out += ",\"lastName\":";
+  appendJsonString(out, author.lastName);
+  out.push_back('}');
+}
+
+void appendJsonWithBookCount(std::string &out, const Author &author,
+                             int bookCount) {
+  out += "{\"booksWritten\":";
+  appendJsonInt(out, bookCount);
+  out += ",\"dob\":";
+  appendJsonString(out, author.dob);
+  out += ",\"firstName\":";
+  appendJsonString(out, author.firstName);
+  out += ",\"id\":";
+  appendJsonInt(out, author.id);
+  out += ",\"lastName\":";
+  appendJsonString(out, author.lastName);
+  out.push_back('}');
+}
+
+void appendJsonWithAuthor(std::string &out, const Book &book,
+                          const Author &author) {
+  out += "{\"author\":";
+  if (author.id != 0) {
+    appendJson(out, author);
+  } else {
+    out += "null";
+  }
+  out += ",\"authorId\":";
+  appendJsonInt(out, book.authorId);
+  out += ",\"genre\":";
+  appendJsonString(out, book.genre);
+  out += ",\"id\":";
+  appendJsonInt(out, book.id);
+  out += ",\"title\":";
+  appendJsonString(out, book.title);
+  out += ",\"year\":";
+  appendJsonInt(out, book.year);
+  out.push_back('}');
+}
+
+} // namespace Library
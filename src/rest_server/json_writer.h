@@ -0,0 +1,25 @@
+#pragma once
+
+#include "database.h"
+
+#include <string>
+#include <string_view>
+
+namespace Library {
+
+// Сериализация записей напрямую в строку, без промежуточного json DOM.
+// Ключи пишутся в алфавитном порядке, как их выводит nlohmann::json::dump()
+void appendJsonString(std::string &out, std::string_view value);
+void appendJsonInt(std::string &out, long long value);
+// Кратчайшее точное представление; целые значения пишутся как "2.0"
+void appendJsonDouble(std::string &out, double value);
+
+void appendJson(std::string &out, const Book &book);
+void appendJson(std::string &out, const Author &author);
+void appendJsonWithBookCount(std::string &out, const Author &author,
+                             int bookCount);
+// Книга со встроенным объектом автора (null, если автор не найден)
+void appendJsonWithAuthor(std::string &out, const Book &book,
+                          const Author &author);
+
+} // namespace Library
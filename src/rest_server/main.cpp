@@ -1,316 +1,657 @@
+#include "database.h"
 #include "httplib.h"
+#include "json_reader.h"
+#include "json_writer.h"
 #include "logger.h"
+#include "metrics.h"
+#include "response_cache.h"
+#include "router.h"
+#include "worker_pool.h"
 #include <algorithm>
+#include <atomic>
+#include <charconv>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <ctime>
+#include <exception>
 #include <iomanip>
 #include <iostream>
-#include <map>
 #include <memory>
-#include <mutex>
 #include <nlohmann/json.hpp>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <toml.hpp>
 #include <vector>
 
 using json = nlohmann::json;
 using namespace httplib;
+using Library::Database;
+
+// Списки длиннее этого порога отдаются потоком и не попадают в кэш ответов
+constexpr std::size_t kMaxCachedListItems = 1000;
+// Пакетная загрузка: строк на одну блокировку базы и ошибок в ответе
+constexpr std::size_t kBulkBatchSize = 10000;
+constexpr std::size_t kMaxReportedBulkErrors = 1000;
+// Выгрузка: строк NDJSON в одном чанке ответа
+constexpr std::size_t kExportRowsPerChunk = 1000;
+// Пакетное получение по списку id: не больше стольких id в запросе
+constexpr std::size_t kMaxMultiGetIds = 100;
+// Лента изменений: событий в ответе и секунд ожидания long-poll
+constexpr int kMaxChangesLimit = 1000;
+constexpr int kMaxChangesWaitSec = 30;
 
-// Класс для хранения данных об авторе
-class Author {
-public:
-  int id;
-  std::string firstName;
-  std::string lastName;
-  std::string dob; // Дата рождения в формате YYYY-MM-DD
-
-  Author() : id(0) {}
-  Author(int id, const std::string &fn, const std::string &ln,
-         const std::string &dob)
-      : id(id), firstName(fn), lastName(ln), dob(dob) {}
+// Функция для создания ответа с ошибкой
+void sendError(Response &res, int status, const std::string &message) {
+  json error = {{"error", true}, {"message", message}};
+  res.set_content(error.dump(), "application/json");
+  res.status = status;
+}
 
-  json toJson() const {
-    return {{"id", id},
-            {"firstName", firstName},
-            {"lastName", lastName},
-            {"dob", dob}};
+// Текст ошибки разбора тела запроса; nullptr, если разбор удался
+const char *decodeError(Library::DecodeStatus status) {
+  switch (status) {
+  case Library::DecodeStatus::Ok:
+    return nullptr;
+  case Library::DecodeStatus::InvalidJson:
+    return "Неверный формат JSON";
+  case Library::DecodeStatus::MissingFields:
+    return "Отсутствуют обязательные поля";
   }
+  return "Неверный формат JSON";
+}
 
-  json toJsonWithBookCount(int bookCount) const {
-    auto j = toJson();
-    j["booksWritten"] = bookCount;
-    return j;
+// Разбирает тело запроса прямо в row (без json DOM); при ошибке отвечает 400
+template <typename Row>
+bool decodeRequest(const Request &req, Response &res, Row &row) {
+  if (const char *error = decodeError(Library::decodeJson(req.body, row))) {
+    sendError(res, 400, error);
+    return false;
   }
-};
-
-// Класс для хранения данных о книге
-class Book {
-public:
-  int id;
-  std::string title;
-  std::string genre;
-  int year;
-  int authorId;
+  return true;
+}
 
-  Book() : id(0), year(0), authorId(0) {}
-  Book(int id, const std::string &t, const std::string &g, int y, int aid)
-      : id(id), title(t), genre(g), year(y), authorId(aid) {}
+// Отдаёт JSON-массив chunked-ответом: элементы сериализуются порциями по мере
+// отправки, поэтому ни DOM, ни весь ответ целиком в памяти не собираются
+template <typename T, typename WriteFn>
+void streamJsonArray(Response &res, std::vector<T> items, WriteFn writeItem) {
+  static constexpr std::size_t kItemsPerChunk = 256;
+
+  auto data = std::make_shared<std::vector<T>>(std::move(items));
+  auto next = std::make_shared<std::size_t>(0);
+
+  res.set_chunked_content_provider(
+      "application/json",
+      [data, next, writeItem](std::size_t, DataSink &sink) {
+        std::string chunk;
+        if (*next == 0) {
+          chunk.push_back('[');
+        }
+
+        std::size_t end = std::min(*next + kItemsPerChunk, data->size());
+        for (; *next < end; ++*next) {
+          if (*next > 0) {
+            chunk.push_back(',');
+          }
+          writeItem(chunk, (*data)[*next]);
+        }
+
+        if (*next == data->size()) {
+          chunk.push_back(']');
+          if (!sink.write(chunk.data(), chunk.size())) {
+            return false;
+          }
+          sink.done();
+          return true;
+        }
+
+        return sink.write(chunk.data(), chunk.size());
+      });
+}
 
-  json toJson() const {
-    return {{"id", id},
-            {"title", title},
-            {"genre", genre},
-            {"year", year},
-            {"authorId", authorId}};
+// Сериализует JSON-массив в одну строку (для ответов, которые кэшируются)
+template <typename T, typename WriteFn>
+std::string serializeJsonArray(const std::vector<T> &items,
+                               WriteFn writeItem) {
+  std::string body;
+  body.reserve(2 + items.size() * 96);
+  body.push_back('[');
+  for (std::size_t i = 0; i < items.size(); ++i) {
+    if (i > 0) {
+      body.push_back(',');
+    }
+    writeItem(body, items[i]);
   }
-};
+  body.push_back(']');
+  return body;
+}
 
-// Класс для хранения данных (простая "база данных" в памяти)
-class Database {
-private:
-  std::map<int, Author> authors;
-  std::map<int, Book> books;
-  int nextAuthorId = 1;
-  int nextBookId = 1;
-  std::mutex mtx;
+// Отдаёт уже сериализованное тело без копирования строки
+void sendBody(Response &res, std::shared_ptr<const std::string> body) {
+  const std::size_t size = body->size();
+  res.set_content_provider(
+      size, "application/json",
+      [body](std::size_t offset, std::size_t length, DataSink &sink) {
+        return sink.write(body->data() + offset, length);
+      });
+}
 
-public:
-  // Авторы
-  Author addAuthor(const std::string &firstName, const std::string &lastName,
-                   const std::string &dob) {
-    std::lock_guard<std::mutex> lock(mtx);
-    Author author(nextAuthorId, firstName, lastName, dob);
-    authors[nextAuthorId] = author;
-    nextAuthorId++;
-    return author;
+// Сильный ETag из версий данных, от которых зависит ответ
+std::string makeEtag(std::initializer_list<std::uint64_t> versions) {
+  std::string etag = "\"";
+  for (auto version : versions) {
+    if (etag.size() > 1) {
+      etag.push_back('-');
+    }
+    etag += std::to_string(version);
   }
+  etag.push_back('"');
+  return etag;
+}
 
-  Author getAuthor(int id) {
-    std::lock_guard<std::mutex> lock(mtx);
-    auto it = authors.find(id);
-    if (it != authors.end()) {
-      return it->second;
-    }
-    return Author(); // Пустой автор если не найден
+// Проверяет If-None-Match: "*" или список ETag через запятую (слабое
+// сравнение, префикс W/ игнорируется)
+bool etagMatches(const Request &req, const std::string &etag) {
+  const std::string header = req.get_header_value("If-None-Match");
+  if (header.empty()) {
+    return false;
   }
 
-  bool updateAuthor(int id, const std::string &firstName,
-                    const std::string &lastName, const std::string &dob) {
-    std::lock_guard<std::mutex> lock(mtx);
-    auto it = authors.find(id);
-    if (it != authors.end()) {
-      it->second.firstName = firstName;
-      it->second.lastName = lastName;
-      it->second.dob = dob;
+  std::size_t pos = 0;
+  while (pos < header.size()) {
+    std::size_t end = header.find(',', pos);
+    if (end == std::string::npos) {
+      end = header.size();
+    }
+
+    std::string_view item(header.data() + pos, end - pos);
+    while (!item.empty() && item.front() == ' ') {
+      item.remove_prefix(1);
+    }
+    while (!item.empty() && item.back() == ' ') {
+      item.remove_suffix(1);
+    }
+    if (item.starts_with("W/")) {
+      item.remove_prefix(2);
+    }
+
+    if (item == "*" || item == etag) {
       return true;
     }
-    return false;
+    pos = end + 1;
   }
+  return false;
+}
 
-  bool deleteAuthor(int id) {
-    std::lock_guard<std::mutex> lock(mtx);
-    // Проверяем, есть ли книги у автора
-    for (const auto &pair : books) {
-      if (pair.second.authorId == id) {
-        return false; // Нельзя удалить автора с книгами
-      }
-    }
+// Выставляет ETag и, если клиент уже имеет эту версию, отвечает 304
+bool notModified(const Request &req, Response &res, const std::string &etag) {
+  res.set_header("ETag", etag);
+  if (etagMatches(req, etag)) {
+    res.status = 304;
+    return true;
+  }
+  return false;
+}
 
-    return authors.erase(id) > 0;
+// Ключ кэша ответов: маршрут, параметры запроса (в httplib они уже
+// отсортированы по имени) и ETag версии данных
+std::string responseCacheKey(const Request &req, const std::string &etag) {
+  std::string key = req.path;
+  for (const auto &[name, value] : req.params) {
+    key += '\n' + std::to_string(name.size()) + ':' + name +
+           std::to_string(value.size()) + ':' + value;
   }
+  key += '\n' + etag;
+  return key;
+}
 
-  std::vector<Author> getAllAuthors() {
-    std::lock_guard<std::mutex> lock(mtx);
-    std::vector<Author> result;
-    for (const auto &pair : authors) {
-      result.push_back(pair.second);
+// Место ожидающего long-poll запроса ленты изменений. Такой запрос держит
+// поток пула всё время ожидания, поэтому одновременно ждать может не больше
+// limit запросов, иначе они заняли бы весь пул и остальные маршруты ушли бы
+// в 503
+class LongPollSlot {
+public:
+  LongPollSlot(std::atomic<std::size_t> &active, std::size_t limit)
+      : active(active) {
+    acquired = active.fetch_add(1) < limit;
+    if (!acquired) {
+      active.fetch_sub(1);
     }
-    return result;
   }
-
-  int getBookCountForAuthor(int authorId) {
-    std::lock_guard<std::mutex> lock(mtx);
-    int count = 0;
-    for (const auto &pair : books) {
-      if (pair.second.authorId == authorId) {
-        count++;
-      }
+  ~LongPollSlot() {
+    if (acquired) {
+      active.fetch_sub(1);
     }
-    return count;
   }
 
-  // Книги
-  Book addBook(const std::string &title, const std::string &genre, int year,
-               int authorId) {
-    std::lock_guard<std::mutex> lock(mtx);
-    // Проверяем существование автора
-    if (authors.find(authorId) == authors.end()) {
-      throw std::runtime_error("Author not found");
+  LongPollSlot(const LongPollSlot &) = delete;
+  LongPollSlot &operator=(const LongPollSlot &) = delete;
+
+  bool isAcquired() const { return acquired; }
+
+private:
+  std::atomic<std::size_t> &active;
+  bool acquired = false;
+};
+
+// Отчёт о пакетной загрузке: ошибки указываются номером строки NDJSON
+struct BulkReport {
+  std::size_t inserted = 0;
+  std::size_t failed = 0;
+  json errors = json::array();
+
+  void fail(std::size_t line, const std::string &message) {
+    ++failed;
+    if (errors.size() < kMaxReportedBulkErrors) {
+      errors.push_back({{"line", line}, {"message", message}});
     }
+  }
 
-    Book book(nextBookId, title, genre, year, authorId);
-    books[nextBookId] = book;
-    nextBookId++;
-    return book;
+  json toJson() const {
+    return {{"inserted", inserted}, {"failed", failed}, {"errors", errors}};
   }
+};
 
-  Book getBook(int id) {
-    std::lock_guard<std::mutex> lock(mtx);
-    auto it = books.find(id);
-    if (it != books.end()) {
-      return it->second;
+// Читает NDJSON из тела запроса по мере поступления, не держа его в памяти
+// целиком. onLine вызывается для каждой непустой строки с её номером (с 1)
+template <typename OnLine>
+void readNdjsonLines(const ContentReader &contentReader, OnLine onLine) {
+  std::string pending;
+  std::size_t lineNo = 0;
+
+  auto consume = [&](std::string_view line) {
+    ++lineNo;
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    if (line.find_first_not_of(" \t") == std::string_view::npos) {
+      return;
     }
-    return Book(); // Пустая книга если не найдена
+    onLine(line, lineNo);
+  };
+
+  contentReader([&](const char *data, std::size_t length) {
+    pending.append(data, length);
+    std::size_t start = 0;
+    for (std::size_t end; (end = pending.find('\n', start)) != std::string::npos;
+         start = end + 1) {
+      consume(std::string_view(pending).substr(start, end - start));
+    }
+    pending.erase(0, start);
+    return true;
+  });
+
+  if (!pending.empty()) {
+    consume(pending);
   }
+}
 
-  bool updateBook(int id, const std::string &title, const std::string &genre,
-                  int year, int authorId) {
-    std::lock_guard<std::mutex> lock(mtx);
-    // Проверяем существование автора
-    if (authors.find(authorId) == authors.end()) {
-      return false;
-    }
+bool parseBookRow(std::string_view line, Library::NewBook &row,
+                  std::string &error) {
+  if (const char *message = decodeError(Library::decodeJson(line, row))) {
+    error = message;
+    return false;
+  }
 
-    auto it = books.find(id);
-    if (it != books.end()) {
-      it->second.title = title;
-      it->second.genre = genre;
-      it->second.year = year;
-      it->second.authorId = authorId;
-      return true;
-    }
+  if (row.title.empty() || row.genre.empty() || row.year < 0) {
+    error = "Неверные данные книги";
     return false;
   }
+  return true;
+}
 
-  bool deleteBook(int id) {
-    std::lock_guard<std::mutex> lock(mtx);
-    return books.erase(id) > 0;
+bool parseAuthorRow(std::string_view line, Library::NewAuthor &row,
+                    std::string &error) {
+  if (const char *message = decodeError(Library::decodeJson(line, row))) {
+    error = message;
+    return false;
   }
 
-  std::vector<Book> getAllBooks() {
-    std::lock_guard<std::mutex> lock(mtx);
-    std::vector<Book> result;
-    for (const auto &pair : books) {
-      result.push_back(pair.second);
-    }
-    return result;
+  if (row.firstName.empty() || row.lastName.empty()) {
+    error = "Имя и фамилия обязательны";
+    return false;
   }
+  return true;
+}
 
-  std::vector<Book> getBooksByGenre(const std::string &genre) {
-    std::lock_guard<std::mutex> lock(mtx);
-    std::vector<Book> result;
-    for (const auto &pair : books) {
-      if (pair.second.genre == genre) {
-        result.push_back(pair.second);
-      }
-    }
-    return result;
+// Курсор для keyset-пагинации: последний отданный id и фильтр, закодированные
+// в hex, чтобы клиент воспринимал курсор как непрозрачную строку
+std::string encodeCursor(int lastId, const std::string &genre) {
+  static constexpr char hex[] = "0123456789abcdef";
+  const std::string raw = json{{"after", lastId}, {"genre", genre}}.dump();
+  std::string cursor;
+  cursor.reserve(raw.size() * 2);
+  for (unsigned char c : raw) {
+    cursor.push_back(hex[c >> 4]);
+    cursor.push_back(hex[c & 0x0F]);
   }
+  return cursor;
+}
 
-  std::vector<Book> getPaginatedBooks(int page, int limit) {
-    std::lock_guard<std::mutex> lock(mtx);
-    std::vector<Book> allBooks;
-    for (const auto &pair : books) {
-      allBooks.push_back(pair.second);
-    }
+bool decodeCursor(const std::string &cursor, int &lastId, std::string &genre) {
+  if (cursor.size() % 2 != 0) {
+    return false;
+  }
 
-    // Применяем пагинацию
-    int start = (page - 1) * limit;
-    if (start < 0)
-      start = 0;
-    if (start >= (int)allBooks.size()) {
-      return {};
+  auto nibble = [](char c) -> int {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    return -1;
+  };
+
+  std::string raw;
+  raw.reserve(cursor.size() / 2);
+  for (std::size_t i = 0; i < cursor.size(); i += 2) {
+    int hi = nibble(cursor[i]);
+    int lo = nibble(cursor[i + 1]);
+    if (hi < 0 || lo < 0) {
+      return false;
     }
-
-    int end = std::min(start + limit, (int)allBooks.size());
-    return std::vector<Book>(allBooks.begin() + start, allBooks.begin() + end);
+    raw.push_back(static_cast<char>((hi << 4) | lo));
   }
 
-  std::vector<Book> getFilteredAndPaginatedBooks(const std::string &genre,
-                                                 int page, int limit) {
-    std::lock_guard<std::mutex> lock(mtx);
-    std::vector<Book> filtered;
+  try {
+    json j = json::parse(raw);
+    lastId = j.at("after");
+    genre = j.at("genre");
+    return true;
+  } catch (const json::exception &e) {
+    return false;
+  }
+}
 
-    // Фильтрация по жанру
-    for (const auto &pair : books) {
-      if (genre.empty() || pair.second.genre == genre) {
-        filtered.push_back(pair.second);
+// Список id через запятую для пакетного получения. Повторы отбрасываются с
+// сохранением порядка; различных id не больше kMaxMultiGetIds
+bool parseIdList(std::string_view text, std::vector<int> &ids) {
+  for (;;) {
+    const std::size_t comma = text.find(',');
+    int id = 0;
+    if (!Library::parseId(text.substr(0, comma), id)) {
+      return false;
+    }
+    if (std::find(ids.begin(), ids.end(), id) == ids.end()) {
+      if (ids.size() == kMaxMultiGetIds) {
+        return false;
       }
+      ids.push_back(id);
     }
 
-    // Применяем пагинацию
-    int start = (page - 1) * limit;
-    if (start < 0)
-      start = 0;
-    if (start >= (int)filtered.size()) {
-      return {};
+    if (comma == std::string_view::npos) {
+      return true;
     }
-
-    int end = std::min(start + limit, (int)filtered.size());
-    return std::vector<Book>(filtered.begin() + start, filtered.begin() + end);
+    text.remove_prefix(comma + 1);
   }
-};
+}
 
-// Глобальная база данных
-Database db;
+// Номер события ленты изменений (seq)
+bool parseSeq(const std::string &text, std::uint64_t &seq) {
+  auto [end, ec] =
+      std::from_chars(text.data(), text.data() + text.size(), seq);
+  return ec == std::errc() && end == text.data() + text.size();
+}
 
-// Функция для парсинга JSON запроса
-bool parseJsonRequest(const Request &req, json &j) {
-  try {
-    j = json::parse(req.body);
-    return true;
-  } catch (const json::exception &e) {
-    return false;
+const char *changeTypeName(Library::ChangeType type) {
+  switch (type) {
+  case Library::ChangeType::Created:
+    return "created";
+  case Library::ChangeType::Updated:
+    return "updated";
+  case Library::ChangeType::Deleted:
+    return "deleted";
   }
+  return "";
 }
 
-// Функция для создания ответа с ошибкой
-void sendError(Response &res, int status, const std::string &message) {
-  json error = {{"error", true}, {"message", message}};
-  res.set_content(error.dump(), "application/json");
-  res.status = status;
+// Тело ответа пакетного получения: {"<key>":[записи],"missing":[id]}.
+// found - найденные записи в порядке ids, отсутствующие в нём пропущены
+template <typename T, typename IdOf, typename WriteFn>
+std::string serializeMultiGet(std::string_view key, const std::vector<int> &ids,
+                              const std::vector<T> &found, IdOf idOf,
+                              WriteFn writeItem) {
+  std::string body;
+  body.reserve(32 + found.size() * 128);
+  body += "{\"";
+  body += key;
+  body += "\":[";
+
+  std::string missing;
+  std::size_t next = 0;
+  for (int id : ids) {
+    if (next < found.size() && idOf(found[next]) == id) {
+      if (next > 0)
+        body.push_back(',');
+      writeItem(body, found[next++]);
+      continue;
+    }
+
+    if (!missing.empty())
+      missing.push_back(',');
+    Library::appendJsonInt(missing, id);
+  }
+
+  body += "],\"missing\":[";
+  body += missing;
+  body += "]}";
+  return body;
 }
 
 int main() {
-  Server svr;
+  toml::table cfg;
+
+  const std::string config_file_path{"cfg.toml"};
+
+  if (!std::filesystem::exists(config_file_path)) {
+    throw std::runtime_error("Config file not found: " + config_file_path);
+  }
+
+  cfg = toml::parse_file(config_file_path);
+
+  Logging::LoggerFactory::Init(cfg);
+
+  // Конфигурация
+  const std::string address{
+      cfg["server_parameters"]["host"].value_or("0.0.0.0")};
+  const unsigned short port{static_cast<unsigned short>(
+      cfg["server_parameters"]["port"].value_or(15000))};
+
+  // Режим синхронизации базы: "mutex", "snapshot" или "sharded"
+  const std::string concurrency{
+      cfg["database"]["concurrency"].value_or("mutex")};
+  const Library::ConcurrencyMode concurrencyMode =
+      concurrency == "snapshot"  ? Library::ConcurrencyMode::Snapshot
+      : concurrency == "sharded" ? Library::ConcurrencyMode::Sharded
+                                 : Library::ConcurrencyMode::Mutex;
+  Database db(concurrencyMode, cfg["database"]["shards"].value_or(16),
+              cfg["changes"]["capacity"].value_or(10000));
+
+  // Кэш сериализованных списков (ключ включает версию данных)
+  Library::ResponseCache responseCache(
+      cfg["cache"]["max_entries"].value_or(256),
+      cfg["cache"]["max_body_size"].value_or(1 << 20));
+
+  auto logger = Logging::LoggerFactory::GetLogger(
+      cfg["logging"]["filename"].value_or("rest_server.log"));
+
+  // Долговременное хранение: снимок + журнал в data_dir
+  const bool durable = cfg["persistence"]["enabled"].value_or(false);
+  if (durable) {
+    const std::string dataDir{
+        cfg["persistence"]["data_dir"].value_or("./data")};
+    const auto started = std::chrono::steady_clock::now();
+    db.open(dataDir);
+    const auto elapsedMs =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - started)
+            .count();
+    LOG_INFO(logger.get(), "Database restored from {} in {} ms", dataDir,
+             elapsedMs);
+  }
+
+  // Периодически сохраняем снимок, чтобы журнал не рос бесконечно
+  const int snapshotIntervalSec =
+      cfg["persistence"]["snapshot_interval_sec"].value_or(300);
+  std::jthread checkpointer([&](std::stop_token stop) {
+    if (!durable) {
+      return;
+    }
+
+    std::mutex waitMtx;
+    std::condition_variable_any wakeUp;
+    std::unique_lock<std::mutex> lock(waitMtx);
+    while (!wakeUp.wait_for(lock, stop,
+                            std::chrono::seconds(snapshotIntervalSec),
+                            [] { return false; })) {
+      try {
+        if (db.checkpoint()) {
+          LOG_INFO(logger.get(), "Database snapshot saved");
+        }
+      } catch (const std::exception &e) {
+        LOG_ERROR(logger.get(), "Database snapshot failed: {}", e.what());
+      }
+    }
+  });
 
-  // Добавление нескольких тестовых данных
-  auto author1 = db.addAuthor("Лев", "Толстой", "1828-09-09");
-  auto author2 = db.addAuthor("Фёдор", "Достоевский", "1821-11-11");
-  auto author3 = db.addAuthor("Айзек", "Азимов", "1920-01-02");
+  Server svr;
 
-  db.addBook("Война и мир", "Роман", 1869, author1.id);
-  db.addBook("Анна Каренина", "Роман", 1877, author1.id);
-  db.addBook("Преступление и наказание", "Роман", 1866, author2.id);
-  db.addBook("Идиот", "Роман", 1869, author2.id);
-  db.addBook("Я, робот", "Фантастика", 1950, author3.id);
-  db.addBook("Основание", "Фантастика", 1951, author3.id);
+  // Пул обработчиков с ограниченной очередью: сверх max_queue соединения
+  // сразу получают 503, а не ждут своей очереди без предела
+  const std::size_t workerThreads = cfg["worker_pool"]["threads"].value_or(0);
+  const std::size_t maxQueue = cfg["worker_pool"]["max_queue"].value_or(256);
+  const std::string retryAfter =
+      std::to_string(cfg["worker_pool"]["retry_after_sec"].value_or(1));
+  Library::WorkerPoolMetrics poolMetrics;
+  // Одновременно ожидающих GET /changes?wait=; 0 - четверть потоков пула
+  const std::size_t maxChangesWaiting =
+      cfg["changes"]["max_waiting"].value_or(0);
+  std::atomic<std::size_t> changesWaiting{0};
+  svr.new_task_queue = [&] {
+    return new Library::WorkerPool(workerThreads, maxQueue, poolMetrics);
+  };
+
+  // Счётчики и задержки запросов по маршрутам; создаются, когда известны
+  // все маршруты (перед запуском сервера)
+  std::optional<Library::RequestMetrics> requestMetrics;
+
+  // GET и DELETE маршруты разбираются без std::regex, см. router.h. Запросы с
+  // телом (POST, PUT) остаются на маршрутах httplib: pre-routing обработчик
+  // вызывается до чтения тела
+  Library::Router router;
+
+  // Добавление нескольких тестовых данных (в пустую базу)
+  if (db.getAllAuthors().empty()) {
+    auto author1 = db.addAuthor("Лев", "Толстой", "1828-09-09");
+    auto author2 = db.addAuthor("Фёдор", "Достоевский", "1821-11-11");
+    auto author3 = db.addAuthor("Айзек", "Азимов", "1920-01-02");
+
+    db.addBook("Война и мир", "Роман", 1869, author1.id);
+    db.addBook("Анна Каренина", "Роман", 1877, author1.id);
+    db.addBook("Преступление и наказание", "Роман", 1866, author2.id);
+    db.addBook("Идиот", "Роман", 1869, author2.id);
+    db.addBook("Я, робот", "Фантастика", 1950, author3.id);
+    db.addBook("Основание", "Фантастика", 1951, author3.id);
+  }
 
   // Корневой маршрут - информация о API
-  svr.Get("/", [](const Request &req, Response &res) {
+  router.get("/", [](const Request &req, Response &res) {
     json response = {
         {"name", "Library Management API"},
         {"version", "1.0.0"},
         {"description", "REST API для управления книгами и авторами"},
         {"endpoints",
          {{"GET /books", "Получить список всех книг"},
+          {"GET /books?ids=1,2,3", "Получить книги по списку ID "
+                                   "(expand=author - вместе с авторами)"},
           {"GET /books/{id}", "Получить книгу по ID"},
+          {"GET /books/search", "Полнотекстовый поиск книг"},
           {"POST /books", "Добавить новую книгу"},
+          {"POST /books:bulk", "Пакетная загрузка книг (NDJSON)"},
+          {"GET /books:export", "Выгрузка всех книг (NDJSON)"},
           {"PUT /books/{id}", "Обновить книгу"},
           {"DELETE /books/{id}", "Удалить книгу"},
           {"GET /authors", "Получить список всех авторов"},
+          {"GET /authors?ids=1,2,3", "Получить авторов по списку ID"},
           {"GET /authors/{id}", "Получить автора по ID"},
           {"POST /authors", "Добавить нового автора"},
+          {"POST /authors:bulk", "Пакетная загрузка авторов (NDJSON)"},
           {"PUT /authors/{id}", "Обновить автора"},
-          {"DELETE /authors/{id}", "Удалить автора"}}}};
+          {"DELETE /authors/{id}", "Удалить автора"},
+          {"GET /stats", "Статистика по жанрам, десятилетиям и авторам"},
+          {"GET /changes", "Лента изменений после since (wait - long-poll)"},
+          {"GET /metrics", "Метрики запросов и блокировок (Prometheus)"}}}};
     res.set_content(response.dump(), "application/json");
   });
 
+  const std::string invalidIdsError = "Неверный параметр ids: нужно до " +
+                                      std::to_string(kMaxMultiGetIds) +
+                                      " id через запятую";
+
   // ========== КНИГИ ==========
 
+  // Книги по списку id одним запросом вместо N запросов GET /books/{id}.
+  // expand=author встраивает в каждую книгу её автора
+  auto getBooksByIds = [&](const Request &req, Response &res) {
+    std::vector<int> ids;
+    if (!parseIdList(req.get_param_value("ids"), ids)) {
+      sendError(res, 400, invalidIdsError);
+      return;
+    }
+
+    const std::string expand = req.get_param_value("expand");
+    if (!expand.empty() && expand != "author") {
+      sendError(res, 400, "Неверный параметр expand");
+      return;
+    }
+    const bool expandAuthor = !expand.empty();
+
+    const auto versions = db.getVersions();
+    const std::string etag =
+        expandAuthor ? makeEtag({versions.authors, versions.books})
+                     : makeEtag({versions.books});
+    if (notModified(req, res, etag)) {
+      return;
+    }
+
+    const std::string cacheKey = responseCacheKey(req, etag);
+    if (auto cached = responseCache.get(cacheKey)) {
+      sendBody(res, cached);
+      return;
+    }
+
+    std::string body;
+    if (expandAuthor) {
+      body = serializeMultiGet(
+          "books", ids, db.getBooksWithAuthors(ids),
+          [](const auto &item) { return item.first.id; },
+          [](std::string &out, const auto &item) {
+            Library::appendJsonWithAuthor(out, item.first, item.second);
+          });
+    } else {
+      body = serializeMultiGet(
+          "books", ids, db.getBooks(ids),
+          [](const Library::Book &book) { return book.id; },
+          [](std::string &out, const Library::Book &book) {
+            Library::appendJson(out, book);
+          });
+    }
+
+    auto sharedBody = std::make_shared<const std::string>(std::move(body));
+    responseCache.put(cacheKey, sharedBody);
+    sendBody(res, sharedBody);
+  };
+
   // Получение всех книг с фильтрацией и пагинацией
-  svr.Get("/books", [](const Request &req, Response &res) {
+  router.get("/books", [&](const Request &req, Response &res) {
+    // Пакетное получение: ?ids=1,2,3 (прочие параметры не учитываются)
+    if (req.has_param("ids")) {
+      getBooksByIds(req, res);
+      return;
+    }
+
     std::string genre = req.get_param_value("genre");
     std::string pageStr = req.get_param_value("page");
     std::string limitStr = req.get_param_value("limit");
@@ -330,24 +671,120 @@ int main() {
     if (limit > 100)
       limit = 100;
 
-    auto books = db.getFilteredAndPaginatedBooks(genre, page, limit);
-    json result = json::array();
-    for (const auto &book : books) {
-      result.push_back(book.toJson());
+    // Диапазон лет, автор и порядок сортировки
+    Library::BookQuery query;
+    std::string yearFromStr = req.get_param_value("yearFrom");
+    std::string yearToStr = req.get_param_value("yearTo");
+    std::string authorIdStr = req.get_param_value("authorId");
+    if (!yearFromStr.empty())
+      query.yearFrom = std::stoi(yearFromStr);
+    if (!yearToStr.empty())
+      query.yearTo = std::stoi(yearToStr);
+    if (!authorIdStr.empty())
+      query.authorId = std::stoi(authorIdStr);
+
+    std::string sort = req.get_param_value("sort");
+    if (sort == "year") {
+      query.sort = Library::BookSort::Year;
+    } else if (sort == "-year") {
+      query.sort = Library::BookSort::YearDesc;
+    } else if (sort == "title") {
+      query.sort = Library::BookSort::Title;
+    } else if (!sort.empty() && sort != "id") {
+      sendError(res, 400, "Неверный параметр sort");
+      return;
+    }
+
+    // Сортировки без подходящего индекса не обходят каталог целиком
+    query.genre = genre;
+    if (!query.isSupported()) {
+      sendError(res, 400, "sort=title нельзя сочетать с фильтрами, "
+                          "sort=year и sort=-year - с genre и authorId");
+      return;
+    }
+
+    // Курсор хранит только жанр и последний id, поэтому работает лишь при
+    // сортировке по id без прочих фильтров
+    const bool cursorCompatible = query.sort == Library::BookSort::Id &&
+                                  !query.hasYearRange() && query.authorId == 0;
+
+    // Курсор (альтернатива page): продолжаем сразу после последней книги
+    std::string cursor = req.get_param_value("cursor");
+    bool useCursor = !cursor.empty();
+    if (useCursor && !cursorCompatible) {
+      sendError(res, 400, "Курсор нельзя сочетать с yearFrom, yearTo, "
+                          "authorId и sort");
+      return;
+    }
+
+    int lastId = 0;
+    if (useCursor) {
+      std::string cursorGenre;
+      if (!decodeCursor(cursor, lastId, cursorGenre) ||
+          (!genre.empty() && genre != cursorGenre)) {
+        sendError(res, 400, "Неверный курсор");
+        return;
+      }
+      genre = cursorGenre;
+    }
+
+    // Версия читается до данных: тело может оказаться только новее ETag
+    const std::string etag = makeEtag({db.getVersions().books});
+    if (notModified(req, res, etag)) {
+      return;
+    }
+
+    const std::string cacheKey = responseCacheKey(req, etag);
+    if (auto cached = responseCache.get(cacheKey)) {
+      sendBody(res, cached);
+      return;
+    }
+
+    Library::BookPage booksPage;
+    if (useCursor) {
+      booksPage = db.getBooksAfter(genre, lastId, limit);
+    } else {
+      query.genre = genre;
+      booksPage = db.findBooks(query, page, limit);
+    }
+
+    // Пишем ответ сразу в строку, без промежуточного json DOM
+    std::string body;
+    body.reserve(128 + booksPage.books.size() * 128);
+    body += "{\"books\":[";
+    for (std::size_t i = 0; i < booksPage.books.size(); ++i) {
+      if (i > 0)
+        body.push_back(',');
+      Library::appendJson(body, booksPage.books[i]);
     }
 
     // Добавляем информацию о пагинации
-    json response = {{"page", page},
-                     {"limit", limit},
-                     {"total", result.size()},
-                     {"books", result}};
+    body += "],\"limit\":";
+    Library::appendJsonInt(body, limit);
+    body += ",\"nextCursor\":";
+    if (cursorCompatible && booksPage.hasMore && !booksPage.books.empty()) {
+      Library::appendJsonString(
+          body, encodeCursor(booksPage.books.back().id, genre));
+    } else {
+      body += "null";
+    }
+    if (!useCursor) {
+      body += ",\"page\":";
+      Library::appendJsonInt(body, page);
+    }
+    body += ",\"total\":";
+    Library::appendJsonInt(body, static_cast<long long>(booksPage.total));
+    body.push_back('}');
 
-    res.set_content(response.dump(), "application/json");
+    auto sharedBody = std::make_shared<const std::string>(std::move(body));
+    responseCache.put(cacheKey, sharedBody);
+    sendBody(res, sharedBody);
   });
 
   // Получение книги по ID
-  svr.Get(R"(/books/(\d+))", [](const Request &req, Response &res) {
-    int id = std::stoi(req.matches[1]);
+  router.get("/books/{id}", [&](const Request &req, Response &res,
+                                   const Library::PathParams &params) {
+    int id = params[0];
     auto book = db.getBook(id);
 
     if (book.id == 0) {
@@ -355,71 +792,191 @@ int main() {
       return;
     }
 
+    if (notModified(req, res, makeEtag({book.version}))) {
+      return;
+    }
+
     res.set_content(book.toJson().dump(), "application/json");
   });
 
-  // Добавление новой книги
-  svr.Post("/books", [](const Request &req, Response &res) {
-    json j;
-    if (!parseJsonRequest(req, j)) {
-      sendError(res, 400, "Неверный формат JSON");
+  // Полнотекстовый поиск по названию книги и имени автора
+  router.get("/books/search", [&](const Request &req, Response &res) {
+    const std::string query = req.get_param_value("q");
+    if (query.empty()) {
+      sendError(res, 400, "Не задан поисковый запрос q");
       return;
     }
 
-    try {
-      std::string title = j.at("title");
-      std::string genre = j.at("genre");
-      int year = j.at("year");
-      int authorId = j.at("authorId");
-
-      // Валидация
-      if (title.empty() || genre.empty() || year < 0) {
-        sendError(res, 400, "Неверные данные книги");
+    int limit = 20;
+    std::string limitStr = req.get_param_value("limit");
+    if (!limitStr.empty())
+      limit = std::stoi(limitStr);
+    if (limit < 1)
+      limit = 20;
+    if (limit > 100)
+      limit = 100;
+
+    // Результат зависит и от книг, и от имён авторов
+    const auto versions = db.getVersions();
+    const std::string etag = makeEtag({versions.authors, versions.books});
+    if (notModified(req, res, etag)) {
+      return;
+    }
+
+    const std::string cacheKey = responseCacheKey(req, etag);
+    if (auto cached = responseCache.get(cacheKey)) {
+      sendBody(res, cached);
+      return;
+    }
+
+    auto found = db.searchBooks(query, limit);
+
+    std::string body;
+    body.reserve(128 + found.hits.size() * 160);
+    body += "{\"limit\":";
+    Library::appendJsonInt(body, limit);
+    body += ",\"query\":";
+    Library::appendJsonString(body, query);
+    body += ",\"results\":[";
+    for (std::size_t i = 0; i < found.hits.size(); ++i) {
+      if (i > 0)
+        body.push_back(',');
+      body += "{\"book\":";
+      Library::appendJson(body, found.hits[i].book);
+      body += ",\"score\":";
+      Library::appendJsonDouble(body, found.hits[i].score);
+      body.push_back('}');
+    }
+    body += "],\"total\":";
+    Library::appendJsonInt(body, static_cast<long long>(found.total));
+    body.push_back('}');
+
+    auto sharedBody = std::make_shared<const std::string>(std::move(body));
+    responseCache.put(cacheKey, sharedBody);
+    sendBody(res, sharedBody);
+  });
+
+  // Пакетная загрузка книг в формате NDJSON (одна книга в строке)
+  svr.Post("/books:bulk", [&](const Request &req, Response &res,
+                              const ContentReader &contentReader) {
+    BulkReport report;
+    std::vector<Library::NewBook> batch;
+    std::vector<std::size_t> batchLines;
+
+    auto flush = [&] {
+      if (batch.empty()) {
         return;
       }
 
-      auto book = db.addBook(title, genre, year, authorId);
+      auto ids = db.addBooks(batch);
+      for (std::size_t i = 0; i < ids.size(); ++i) {
+        if (ids[i] == 0) {
+          report.fail(batchLines[i], "Автор не найден");
+        } else {
+          ++report.inserted;
+        }
+      }
+      batch.clear();
+      batchLines.clear();
+    };
+
+    readNdjsonLines(contentReader, [&](std::string_view line,
+                                       std::size_t lineNo) {
+      Library::NewBook row;
+      std::string error;
+      if (!parseBookRow(line, row, error)) {
+        report.fail(lineNo, error);
+        return;
+      }
+
+      batch.push_back(std::move(row));
+      batchLines.push_back(lineNo);
+      if (batch.size() >= kBulkBatchSize) {
+        flush();
+      }
+    });
+    flush();
+
+    res.set_content(report.toJson().dump(), "application/json");
+  });
+
+  // Выгрузка всех книг в NDJSON из согласованного снимка базы
+  router.get("/books:export", [&](const Request &req, Response &res) {
+    auto books = db.getBooksSnapshot();
+    auto next = std::make_shared<Database::BookTable::const_iterator>(
+        books->begin());
+
+    res.set_chunked_content_provider(
+        "application/x-ndjson",
+        [books, next](std::size_t, DataSink &sink) {
+          std::string chunk;
+          for (std::size_t n = 0;
+               *next != books->end() && n < kExportRowsPerChunk;
+               ++*next, ++n) {
+            Library::appendJson(chunk, (*next)->second);
+            chunk.push_back('\n');
+          }
+
+          if (!chunk.empty() && !sink.write(chunk.data(), chunk.size())) {
+            return false;
+          }
+          if (*next == books->end()) {
+            sink.done();
+          }
+          return true;
+        });
+  });
+
+  // Добавление новой книги
+  svr.Post("/books", [&](const Request &req, Response &res) {
+    Library::NewBook row;
+    if (!decodeRequest(req, res, row)) {
+      return;
+    }
+
+    // Валидация
+    if (row.title.empty() || row.genre.empty() || row.year < 0) {
+      sendError(res, 400, "Неверные данные книги");
+      return;
+    }
+
+    try {
+      auto book = db.addBook(row.title, row.genre, row.year, row.authorId);
 
       res.status = 201;
       res.set_content(book.toJson().dump(), "application/json");
-    } catch (const json::exception &e) {
-      sendError(res, 400, "Отсутствуют обязательные поля");
-    } catch (const std::runtime_error &e) {
+    } catch (const Library::AuthorNotFound &) {
       sendError(res, 404, "Автор не найден");
     }
   });
 
   // Обновление книги
-  svr.Put(R"(/books/(\d+))", [](const Request &req, Response &res) {
-    int id = std::stoi(req.matches[1]);
-    json j;
-    if (!parseJsonRequest(req, j)) {
-      sendError(res, 400, "Неверный формат JSON");
+  svr.Put("/books/:id", [&](const Request &req, Response &res) {
+    int id = 0;
+    if (!Library::parseId(req.path_params.at("id"), id)) {
+      sendError(res, 404, "Книга не найдена");
+      return;
+    }
+    Library::NewBook row;
+    if (!decodeRequest(req, res, row)) {
       return;
     }
 
-    try {
-      std::string title = j.at("title");
-      std::string genre = j.at("genre");
-      int year = j.at("year");
-      int authorId = j.at("authorId");
-
-      bool success = db.updateBook(id, title, genre, year, authorId);
-      if (!success) {
-        sendError(res, 404, "Книга или автор не найдены");
-        return;
-      }
-
-      auto updatedBook = db.getBook(id);
-      res.set_content(updatedBook.toJson().dump(), "application/json");
-    } catch (const json::exception &e) {
-      sendError(res, 400, "Отсутствуют обязательные поля");
+    bool success =
+        db.updateBook(id, row.title, row.genre, row.year, row.authorId);
+    if (!success) {
+      sendError(res, 404, "Книга или автор не найдены");
+      return;
     }
+
+    auto updatedBook = db.getBook(id);
+    res.set_content(updatedBook.toJson().dump(), "application/json");
   });
 
   // Удаление книги
-  svr.Delete(R"(/books/(\d+))", [](const Request &req, Response &res) {
-    int id = std::stoi(req.matches[1]);
+  router.del("/books/{id}", [&](const Request &req, Response &res,
+                                   const Library::PathParams &params) {
+    int id = params[0];
     bool success = db.deleteBook(id);
 
     if (!success) {
@@ -433,28 +990,87 @@ int main() {
   // ========== АВТОРЫ ==========
 
   // Получение всех авторов
-  svr.Get("/authors", [](const Request &req, Response &res) {
-    auto authors = db.getAllAuthors();
-    json result = json::array();
+  router.get("/authors", [&](const Request &req, Response &res) {
+    // Пакетное получение: ?ids=1,2,3 вместо N запросов GET /authors/{id}
+    const bool byIds = req.has_param("ids");
+    std::vector<int> ids;
+    if (byIds && !parseIdList(req.get_param_value("ids"), ids)) {
+      sendError(res, 400, invalidIdsError);
+      return;
+    }
 
     // Бонус: добавляем количество книг для каждого автора
     bool includeBookCount = req.get_param_value("includeBooks") == "true";
 
-    for (const auto &author : authors) {
+    // Количество книг зависит и от версии книг
+    const auto versions = db.getVersions();
+    const std::string etag =
+        includeBookCount ? makeEtag({versions.authors, versions.books})
+                         : makeEtag({versions.authors});
+    if (notModified(req, res, etag)) {
+      return;
+    }
+
+    const std::string cacheKey = responseCacheKey(req, etag);
+    if (auto cached = responseCache.get(cacheKey)) {
+      sendBody(res, cached);
+      return;
+    }
+
+    if (byIds) {
+      std::string body;
       if (includeBookCount) {
-        int bookCount = db.getBookCountForAuthor(author.id);
-        result.push_back(author.toJsonWithBookCount(bookCount));
+        body = serializeMultiGet(
+            "authors", ids, db.getAuthorsWithBookCounts(ids),
+            [](const auto &item) { return item.first.id; },
+            [](std::string &out, const auto &item) {
+              Library::appendJsonWithBookCount(out, item.first, item.second);
+            });
       } else {
-        result.push_back(author.toJson());
+        body = serializeMultiGet(
+            "authors", ids, db.getAuthors(ids),
+            [](const Library::Author &author) { return author.id; },
+            [](std::string &out, const Library::Author &author) {
+              Library::appendJson(out, author);
+            });
       }
+
+      auto sharedBody = std::make_shared<const std::string>(std::move(body));
+      responseCache.put(cacheKey, sharedBody);
+      sendBody(res, sharedBody);
+      return;
     }
 
-    res.set_content(result.dump(), "application/json");
+    // Большие списки отдаём потоком и не кэшируем
+    auto respond = [&](auto items, auto writeItem) {
+      if (items.size() > kMaxCachedListItems) {
+        streamJsonArray(res, std::move(items), writeItem);
+        return;
+      }
+
+      auto body = std::make_shared<const std::string>(
+          serializeJsonArray(items, writeItem));
+      responseCache.put(cacheKey, body);
+      sendBody(res, body);
+    };
+
+    if (includeBookCount) {
+      respond(db.getAllAuthorsWithBookCounts(),
+              [](std::string &out, const auto &item) {
+                Library::appendJsonWithBookCount(out, item.first, item.second);
+              });
+    } else {
+      respond(db.getAllAuthors(),
+              [](std::string &out, const Library::Author &author) {
+                Library::appendJson(out, author);
+              });
+    }
   });
 
   // Получение автора по ID
-  svr.Get(R"(/authors/(\d+))", [](const Request &req, Response &res) {
-    int id = std::stoi(req.matches[1]);
+  router.get("/authors/{id}", [&](const Request &req, Response &res,
+                                   const Library::PathParams &params) {
+    int id = params[0];
     auto author = db.getAuthor(id);
 
     if (author.id == 0) {
@@ -464,6 +1080,14 @@ int main() {
 
     // Бонус: добавляем количество книг
     bool includeBookCount = req.get_param_value("includeBooks") == "true";
+    const std::string etag =
+        includeBookCount
+            ? makeEtag({author.version, db.getVersions().books})
+            : makeEtag({author.version});
+    if (notModified(req, res, etag)) {
+      return;
+    }
+
     if (includeBookCount) {
       int bookCount = db.getBookCountForAuthor(author.id);
       res.set_content(author.toJsonWithBookCount(bookCount).dump(),
@@ -473,64 +1097,86 @@ int main() {
     }
   });
 
-  // Добавление нового автора
-  svr.Post("/authors", [](const Request &req, Response &res) {
-    json j;
-    if (!parseJsonRequest(req, j)) {
-      sendError(res, 400, "Неверный формат JSON");
-      return;
-    }
+  // Пакетная загрузка авторов в формате NDJSON (один автор в строке)
+  svr.Post("/authors:bulk", [&](const Request &req, Response &res,
+                                const ContentReader &contentReader) {
+    BulkReport report;
+    std::vector<Library::NewAuthor> batch;
 
-    try {
-      std::string firstName = j.at("firstName");
-      std::string lastName = j.at("lastName");
-      std::string dob = j.at("dob");
+    auto flush = [&] {
+      if (batch.empty()) {
+        return;
+      }
+
+      report.inserted += db.addAuthors(batch).size();
+      batch.clear();
+    };
 
-      // Валидация
-      if (firstName.empty() || lastName.empty()) {
-        sendError(res, 400, "Имя и фамилия обязательны");
+    readNdjsonLines(contentReader, [&](std::string_view line,
+                                       std::size_t lineNo) {
+      Library::NewAuthor row;
+      std::string error;
+      if (!parseAuthorRow(line, row, error)) {
+        report.fail(lineNo, error);
         return;
       }
 
-      auto author = db.addAuthor(firstName, lastName, dob);
+      batch.push_back(std::move(row));
+      if (batch.size() >= kBulkBatchSize) {
+        flush();
+      }
+    });
+    flush();
 
-      res.status = 201;
-      res.set_content(author.toJson().dump(), "application/json");
-    } catch (const json::exception &e) {
-      sendError(res, 400, "Отсутствуют обязательные поля");
-    }
+    res.set_content(report.toJson().dump(), "application/json");
   });
 
-  // Обновление автора
-  svr.Put(R"(/authors/(\d+))", [](const Request &req, Response &res) {
-    int id = std::stoi(req.matches[1]);
-    json j;
-    if (!parseJsonRequest(req, j)) {
-      sendError(res, 400, "Неверный формат JSON");
+  // Добавление нового автора
+  svr.Post("/authors", [&](const Request &req, Response &res) {
+    Library::NewAuthor row;
+    if (!decodeRequest(req, res, row)) {
       return;
     }
 
-    try {
-      std::string firstName = j.at("firstName");
-      std::string lastName = j.at("lastName");
-      std::string dob = j.at("dob");
+    // Валидация
+    if (row.firstName.empty() || row.lastName.empty()) {
+      sendError(res, 400, "Имя и фамилия обязательны");
+      return;
+    }
 
-      bool success = db.updateAuthor(id, firstName, lastName, dob);
-      if (!success) {
-        sendError(res, 404, "Автор не найден");
-        return;
-      }
+    auto author = db.addAuthor(row.firstName, row.lastName, row.dob);
+
+    res.status = 201;
+    res.set_content(author.toJson().dump(), "application/json");
+  });
+
+  // Обновление автора
+  svr.Put("/authors/:id", [&](const Request &req, Response &res) {
+    int id = 0;
+    if (!Library::parseId(req.path_params.at("id"), id)) {
+      sendError(res, 404, "Автор не найден");
+      return;
+    }
+    Library::NewAuthor row;
+    if (!decodeRequest(req, res, row)) {
+      return;
+    }
 
-      auto updatedAuthor = db.getAuthor(id);
-      res.set_content(updatedAuthor.toJson().dump(), "application/json");
-    } catch (const json::exception &e) {
-      sendError(res, 400, "Отсутствуют обязательные поля");
+    bool success =
+        db.updateAuthor(id, row.firstName, row.lastName, row.dob);
+    if (!success) {
+      sendError(res, 404, "Автор не найден");
+      return;
     }
+
+    auto updatedAuthor = db.getAuthor(id);
+    res.set_content(updatedAuthor.toJson().dump(), "application/json");
   });
 
   // Удаление автора
-  svr.Delete(R"(/authors/(\d+))", [](const Request &req, Response &res) {
-    int id = std::stoi(req.matches[1]);
+  router.del("/authors/{id}", [&](const Request &req, Response &res,
+                                   const Library::PathParams &params) {
+    int id = params[0];
     bool success = db.deleteAuthor(id);
 
     if (!success) {
@@ -541,15 +1187,228 @@ int main() {
     res.status = 204;
   });
 
+  // ========== СТАТИСТИКА ==========
+
+  // Сводка по жанрам, десятилетиям и самым продуктивным авторам
+  router.get("/stats", [&](const Request &req, Response &res) {
+    int top = 10;
+    std::string topStr = req.get_param_value("top");
+    if (!topStr.empty())
+      top = std::stoi(topStr);
+    if (top < 0)
+      top = 10;
+    if (top > 100)
+      top = 100;
+
+    const auto versions = db.getVersions();
+    const std::string etag = makeEtag({versions.authors, versions.books});
+    if (notModified(req, res, etag)) {
+      return;
+    }
+
+    const std::string cacheKey = responseCacheKey(req, etag);
+    if (auto cached = responseCache.get(cacheKey)) {
+      sendBody(res, cached);
+      return;
+    }
+
+    auto stats = db.getStats(top);
+
+    json genres = json::object();
+    for (const auto &[genre, count] : stats.genres) {
+      genres[genre] = count;
+    }
+    json decades = json::array();
+    for (const auto &[decade, count] : stats.decades) {
+      decades.push_back({{"decade", decade}, {"books", count}});
+    }
+    json topAuthors = json::array();
+    for (const auto &[author, count] : stats.topAuthors) {
+      topAuthors.push_back(author.toJsonWithBookCount(count));
+    }
+
+    json response = {{"authors", stats.authors},
+                     {"books", stats.books},
+                     {"genres", genres},
+                     {"decades", decades},
+                     {"topAuthors", topAuthors}};
+
+    auto body = std::make_shared<const std::string>(response.dump());
+    responseCache.put(cacheKey, body);
+    sendBody(res, body);
+  });
+
+  // ========== ЛЕНТА ИЗМЕНЕНИЙ ==========
+
+  // События после since для инкрементальной синхронизации. wait - long-poll:
+  // сколько секунд ждать первого события, если новых ещё нет
+  router.get("/changes", [&](const Request &req, Response &res) {
+    std::uint64_t since = 0;
+    std::string sinceStr = req.get_param_value("since");
+    if (!sinceStr.empty() && !parseSeq(sinceStr, since)) {
+      sendError(res, 400, "Неверный параметр since");
+      return;
+    }
+
+    int limit = 100;
+    int waitSec = 0;
+    std::string limitStr = req.get_param_value("limit");
+    std::string waitStr = req.get_param_value("wait");
+    if (!limitStr.empty())
+      limit = std::stoi(limitStr);
+    if (!waitStr.empty())
+      waitSec = std::stoi(waitStr);
+
+    if (limit < 1)
+      limit = 100;
+    if (limit > kMaxChangesLimit)
+      limit = kMaxChangesLimit;
+    waitSec = std::clamp(waitSec, 0, kMaxChangesWaitSec);
+
+    // Число потоков пула известно только после его запуска
+    const std::size_t waitLimit =
+        maxChangesWaiting != 0
+            ? maxChangesWaiting
+            : std::max<std::size_t>(1, poolMetrics.threads.load() / 4);
+    std::optional<LongPollSlot> slot;
+    if (waitSec > 0) {
+      slot.emplace(changesWaiting, waitLimit);
+    }
+    const bool canWait = slot && slot->isAcquired();
+
+    // Без свободного места запрос не ждёт: готовые события отдаются как
+    // обычно, а пустой ответ заменяется на 429
+    const auto page = db.getChanges(
+        since, limit, std::chrono::seconds(canWait ? waitSec : 0));
+    slot.reset();
+    res.set_header("Cache-Control", "no-store");
+
+    if (waitSec > 0 && !canWait && !page.resyncRequired &&
+        page.changes.empty()) {
+      res.set_header("Retry-After", retryAfter);
+      sendError(res, 429, "Слишком много ожидающих запросов ленты изменений");
+      return;
+    }
+
+    // Потребитель отстал больше, чем хранит лента: 410 и точка продолжения
+    if (page.resyncRequired) {
+      json error = {{"error", true},
+                    {"message", "События после since уже недоступны, "
+                                "нужна полная пересинхронизация"},
+                    {"resyncRequired", true},
+                    {"lastSeq", page.lastSeq}};
+      res.set_content(error.dump(), "application/json");
+      res.status = 410;
+      return;
+    }
+
+    json changes = json::array();
+    for (const auto &change : page.changes) {
+      const bool isBook = change.entity == Library::ChangeEntity::Book;
+      json item = {{"seq", change.seq},
+                   {"type", changeTypeName(change.type)},
+                   {"entity", isBook ? "book" : "author"},
+                   {"id", change.id},
+                   {"version", change.version}};
+      if (change.type != Library::ChangeType::Deleted) {
+        item[isBook ? "book" : "author"] =
+            isBook ? change.book.toJson() : change.author.toJson();
+      }
+      changes.push_back(std::move(item));
+    }
+
+    json response = {
+        {"changes", std::move(changes)},
+        {"lastSeq", page.lastSeq},
+        {"nextSince",
+         page.changes.empty() ? since : page.changes.back().seq}};
+    res.set_content(response.dump(), "application/json");
+  });
+
   // Маршрут для проверки здоровья сервера
-  svr.Get("/health", [](const Request &req, Response &res) {
+  router.get("/health", [&](const Request &req, Response &res) {
+    const std::uint64_t started = poolMetrics.started;
+    const std::uint64_t waitMicrosTotal = poolMetrics.waitMicrosTotal;
     json response = {
         {"status", "ok"},
         {"timestamp",
-         std::chrono::system_clock::now().time_since_epoch().count()}};
+         std::chrono::system_clock::now().time_since_epoch().count()},
+        {"workerPool",
+         {{"threads", poolMetrics.threads.load()},
+          {"busy", poolMetrics.busy.load()},
+          {"queueDepth", poolMetrics.queueDepth.load()},
+          {"maxQueue", poolMetrics.maxQueue.load()},
+          {"accepted", poolMetrics.accepted.load()},
+          {"shed", poolMetrics.shed.load()},
+          {"dropped", poolMetrics.dropped.load()},
+          {"avgWaitMs",
+           started > 0 ? waitMicrosTotal / 1000.0 / started : 0.0},
+          {"maxWaitMs", poolMetrics.waitMicrosMax / 1000.0}}}};
     res.set_content(response.dump(), "application/json");
   });
 
+  // Метрики в текстовом формате Prometheus: запросы по маршрутам, ожидание
+  // блокировок базы и пул обработчиков. Ожидание блокировок отделяет
+  // конкуренцию потоков от времени самой работы под блокировкой
+  router.get("/metrics", [&](const Request &req, Response &res) {
+    std::string out;
+    requestMetrics->appendPrometheus(out);
+
+    const auto lockWaits = db.getLockWaits();
+    std::string databaseLabels;
+    std::string shardLabels;
+    Library::appendPrometheusLabel(databaseLabels, "lock", "database");
+    Library::appendPrometheusLabel(shardLabels, "lock", "shard");
+    Library::appendPrometheusHeader(
+        out, "rest_server_db_lock_wait_seconds", "histogram",
+        "Time spent waiting for database locks (zero when uncontended)");
+    Library::appendPrometheusHistogram(out, "rest_server_db_lock_wait_seconds",
+                                       databaseLabels, lockWaits.database);
+    Library::appendPrometheusHistogram(out, "rest_server_db_lock_wait_seconds",
+                                       shardLabels, lockWaits.shards);
+    Library::appendPrometheusHeader(
+        out, "rest_server_db_lock_wait_quantiles_seconds", "summary",
+        "Database lock wait quantiles with 12.5% relative error");
+    Library::appendPrometheusSummary(
+        out, "rest_server_db_lock_wait_quantiles_seconds", databaseLabels,
+        lockWaits.database);
+    Library::appendPrometheusSummary(
+        out, "rest_server_db_lock_wait_quantiles_seconds", shardLabels,
+        lockWaits.shards);
+
+    const std::pair<const char *, double> gauges[] = {
+        {"threads", poolMetrics.threads.load()},
+        {"busy", poolMetrics.busy.load()},
+        {"queue_depth", poolMetrics.queueDepth.load()},
+        {"max_queue", poolMetrics.maxQueue.load()}};
+    for (const auto &[name, value] : gauges) {
+      const std::string metric = std::string("rest_server_worker_pool_") + name;
+      Library::appendPrometheusHeader(out, metric, "gauge",
+                                      "Worker pool state");
+      Library::appendPrometheusSample(out, metric, "", value);
+    }
+    const std::pair<const char *, double> counters[] = {
+        {"accepted", poolMetrics.accepted.load()},
+        {"shed", poolMetrics.shed.load()},
+        {"dropped", poolMetrics.dropped.load()}};
+    for (const auto &[name, value] : counters) {
+      const std::string metric =
+          std::string("rest_server_worker_pool_") + name + "_total";
+      Library::appendPrometheusHeader(out, metric, "counter",
+                                      "Connections by worker pool outcome");
+      Library::appendPrometheusSample(out, metric, "", value);
+    }
+    Library::appendPrometheusHeader(
+        out, "rest_server_worker_pool_queue_wait_seconds_total", "counter",
+        "Total time connections waited for a worker");
+    Library::appendPrometheusSample(
+        out, "rest_server_worker_pool_queue_wait_seconds_total", "",
+        poolMetrics.waitMicrosTotal / 1e6);
+
+    res.set_header("Cache-Control", "no-store");
+    res.set_content(out, "text/plain; version=0.0.4");
+  });
+
   // Обработка CORS (Cross-Origin Resource Sharing)
   svr.Options(".*", [](const Request &req, Response &res) {
     res.set_header("Access-Control-Allow-Origin", "*");
@@ -559,46 +1418,90 @@ int main() {
   });
 
   // Добавляем CORS заголовки ко всем ответам
-  svr.set_pre_routing_handler([](const Request &req, Response &res) {
+  // и обслуживаем запросы без тела по таблице маршрутов router
+  svr.set_pre_routing_handler([&](const Request &req, Response &res) {
+    Library::RequestMetrics::begin();
     res.set_header("Access-Control-Allow-Origin", "*");
-    return Server::HandlerResponse::Unhandled;
+    // Соединение пришло сверх очереди пула: отвечаем сразу, не трогая базу
+    if (Library::WorkerPool::isShedding()) {
+      res.set_header("Retry-After", retryAfter);
+      res.set_header("Connection", "close");
+      sendError(res, 503, "Сервер перегружен, повторите запрос позже");
+      return Server::HandlerResponse::Handled;
+    }
+    return router.dispatch(req, res) ? Server::HandlerResponse::Handled
+                                     : Server::HandlerResponse::Unhandled;
   });
 
-  toml::table cfg;
-
-  const std::string config_file_path{"cfg.toml"};
-
-  if (!std::filesystem::exists(config_file_path)) {
-    throw std::runtime_error("Config file not found: " + config_file_path);
-  }
-
-  cfg = toml::parse_file(config_file_path);
-
-  Logging::LoggerFactory::Init(cfg);
+  // Исключения обработчиков (и router, и httplib): отказ журнала - 503, чтобы
+  // клиент не искал ошибку в своём запросе, прочее - 500
+  svr.set_exception_handler([&](const Request &req, Response &res,
+                                std::exception_ptr ep) {
+    try {
+      std::rethrow_exception(ep);
+    } catch (const Library::StorageUnavailable &e) {
+      LOG_ERROR(logger.get(), "{} {}: {}", req.method, req.path, e.what());
+      sendError(res, 503, "Хранилище недоступно");
+    } catch (const std::exception &e) {
+      LOG_ERROR(logger.get(), "{} {}: {}", req.method, req.path, e.what());
+      sendError(res, 500, "Внутренняя ошибка сервера");
+    } catch (...) {
+      sendError(res, 500, "Внутренняя ошибка сервера");
+    }
+  });
 
-  // Конфигурация
-  const std::string address{
-      cfg["server_parameters"]["host"].value_or("0.0.0.0")};
-  const unsigned short port{static_cast<unsigned short>(
-      cfg["server_parameters"]["port"].value_or(15000))};
+  // Маршруты router и маршруты httplib для запросов с телом
+  auto metricRoutes = router.routes();
+  metricRoutes.insert(metricRoutes.end(), {{"POST", "/books"},
+                                           {"POST", "/books:bulk"},
+                                           {"PUT", "/books/{id}"},
+                                           {"POST", "/authors"},
+                                           {"POST", "/authors:bulk"},
+                                           {"PUT", "/authors/{id}"}});
+  requestMetrics.emplace(metricRoutes);
+
+  // Вызывается после отправки каждого ответа, в том же потоке, что и
+  // pre-routing обработчик
+  svr.set_logger([&](const Request &req, const Response &res) {
+    requestMetrics->end(req.method, req.path, res.status);
+  });
 
   std::cout << std::format("Сервер запущен на http://{}:{}", address, port)
             << std::endl;
   std::cout << "Доступные эндпоинты:" << std::endl;
   std::cout << "  GET  / - информация о API" << std::endl;
-  std::cout << "  GET  /books - список книг (genre, page, limit параметры)"
+  std::cout
+      << "  GET  /books - список книг (genre, yearFrom, yearTo, authorId, sort, "
+         "page, cursor, limit параметры)"
+      << std::endl;
+  std::cout << "  GET  /books?ids=1,2,3 - книги по списку ID (expand=author)"
             << std::endl;
   std::cout << "  GET  /books/{id} - книга по ID" << std::endl;
+  std::cout << "  GET  /books/search - поиск по названию и автору (q, limit)"
+            << std::endl;
   std::cout << "  POST /books - добавить книгу" << std::endl;
+  std::cout << "  POST /books:bulk - пакетная загрузка книг (NDJSON)"
+            << std::endl;
+  std::cout << "  GET  /books:export - выгрузка всех книг (NDJSON)"
+            << std::endl;
   std::cout << "  PUT  /books/{id} - обновить книгу" << std::endl;
   std::cout << "  DELETE /books/{id} - удалить книгу" << std::endl;
   std::cout << "  GET  /authors - список авторов (includeBooks=true параметр)"
             << std::endl;
+  std::cout << "  GET  /authors?ids=1,2,3 - авторы по списку ID" << std::endl;
   std::cout << "  GET  /authors/{id} - автор по ID" << std::endl;
   std::cout << "  POST /authors - добавить автора" << std::endl;
+  std::cout << "  POST /authors:bulk - пакетная загрузка авторов (NDJSON)"
+            << std::endl;
   std::cout << "  PUT  /authors/{id} - обновить автора" << std::endl;
   std::cout << "  DELETE /authors/{id} - удалить автора" << std::endl;
-  std::cout << "  GET  /health - проверка здоровья сервера" << std::endl;
+  std::cout << "  GET  /stats - статистика библиотеки (top параметр)"
+            << std::endl;
+  std::cout << "  GET  /changes - лента изменений (since, limit, wait параметры)"
+            << std::endl;
+  std::cout << "  GET  /health - проверка здоровья сервера и очередь запросов"
+            << std::endl;
+  std::cout << "  GET  /metrics - метрики в формате Prometheus" << std::endl;
 
   svr.listen(address.c_str(), port);
 
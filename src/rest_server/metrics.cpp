@@ -0,0 +1,381 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cmath>
+
+namespace Library {
+
+namespace {
+
+std::atomic<std::uint64_t> nextCountersId{1};
+
+// Шарды текущего потока: id набора -> его шард. Наборов в процессе единицы,
+// линейного поиска достаточно
+thread_local std::vector<std::pair<std::uint64_t, void *>> localShards;
+
+thread_local std::chrono::steady_clock::time_point requestStarted;
+thread_local bool requestBegun = false;
+
+constexpr std::array<double, 4> kQuantiles = {0.5, 0.9, 0.99, 0.999};
+
+// Границы корзин Prometheus: степени двойки от 2^10 нс (~1 мкс)
+// до 2^36 нс (~69 с)
+constexpr unsigned kPrometheusFirstExponent = 10;
+constexpr unsigned kPrometheusLastExponent = 36;
+
+bool isNumber(std::string_view segment) {
+  return !segment.empty() &&
+         std::all_of(segment.begin(), segment.end(),
+                     [](char c) { return c >= '0' && c <= '9'; });
+}
+
+// "МЕТОД /путь/{id}" для поиска серии
+void appendRouteKey(std::string &key, std::string_view method,
+                    std::string_view path) {
+  key.append(method);
+  key += ' ';
+  while (!path.empty()) {
+    const std::size_t slash = path.find('/', 1);
+    const std::string_view segment = path.substr(0, slash);
+    if (segment.size() > 1 && isNumber(segment.substr(1))) {
+      key += "/{id}";
+    } else {
+      key.append(segment);
+    }
+    path = slash == std::string_view::npos ? std::string_view()
+                                           : path.substr(slash);
+  }
+}
+
+void appendDouble(std::string &out, double value) {
+  char buffer[32];
+  auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  out.append(buffer, end);
+}
+
+double toSeconds(std::uint64_t nanos) { return nanos / 1e9; }
+
+} // namespace
+
+// ========== СЧЁТЧИКИ ==========
+
+ShardedCounters::ShardedCounters(std::size_t size)
+    : count(size), id(nextCountersId.fetch_add(1)) {}
+
+ShardedCounters::~ShardedCounters() = default;
+
+ShardedCounters::Line *ShardedCounters::localShard() {
+  for (const auto &[shardOwner, shard] : localShards) {
+    if (shardOwner == id) {
+      return static_cast<Line *>(shard);
+    }
+  }
+
+  // Первая запись потока: блокировка берётся один раз на поток
+  const std::size_t lines = (count + 7) / 8;
+  Line *shard = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    shards.push_back(std::make_unique<Line[]>(lines));
+    shard = shards.back().get();
+  }
+  localShards.emplace_back(id, shard);
+  return shard;
+}
+
+void ShardedCounters::add(std::size_t index, std::uint64_t value) {
+  // Пишет только поток-владелец шарда, поэтому хватает load + store без
+  // атомарного read-modify-write
+  auto &slot = localShard()[index / 8].values[index % 8];
+  slot.store(slot.load(std::memory_order_relaxed) + value,
+             std::memory_order_relaxed);
+}
+
+std::vector<std::uint64_t> ShardedCounters::sum() const {
+  std::vector<std::uint64_t> result(count);
+  std::lock_guard<std::mutex> lock(mtx);
+  for (const auto &shard : shards) {
+    for (std::size_t i = 0; i < count; ++i) {
+      result[i] += shard[i / 8].values[i % 8].load(std::memory_order_relaxed);
+    }
+  }
+  return result;
+}
+
+// ========== ГИСТОГРАММЫ ==========
+
+std::size_t LatencyHistogram::bucketOf(std::uint64_t nanos) {
+  if (nanos < (1u << kSubBits)) {
+    return static_cast<std::size_t>(nanos);
+  }
+  const unsigned exponent = std::bit_width(nanos) - 1;
+  if (exponent >= kMaxExponent) {
+    return kBucketCount - 1;
+  }
+  const std::size_t sub =
+      (nanos >> (exponent - kSubBits)) & ((1u << kSubBits) - 1);
+  return (static_cast<std::size_t>(exponent - kSubBits + 1) << kSubBits) + sub;
+}
+
+std::uint64_t LatencyHistogram::lowerBound(std::size_t bucket) {
+  if (bucket < (1u << kSubBits)) {
+    return bucket;
+  }
+  const unsigned exponent =
+      static_cast<unsigned>(bucket >> kSubBits) + kSubBits - 1;
+  const std::uint64_t sub = bucket & ((1u << kSubBits) - 1);
+  return ((std::uint64_t{1} << kSubBits) + sub) << (exponent - kSubBits);
+}
+
+std::uint64_t LatencyHistogram::countBelow(std::uint64_t nanos) const {
+  std::uint64_t result = 0;
+  for (std::size_t i = 0; i < kBucketCount && lowerBound(i + 1) <= nanos;
+       ++i) {
+    result += buckets[i];
+  }
+  return result;
+}
+
+std::uint64_t LatencyHistogram::quantile(double q) const {
+  if (count == 0) {
+    return 0;
+  }
+  const auto rank = static_cast<std::uint64_t>(
+      std::ceil(std::clamp(q, 0.0, 1.0) * static_cast<double>(count)));
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < kBucketCount; ++i) {
+    seen += buckets[i];
+    if (seen >= std::max<std::uint64_t>(rank, 1)) {
+      return lowerBound(i + 1);
+    }
+  }
+  return lowerBound(kBucketCount);
+}
+
+LatencyRecorder::LatencyRecorder(std::size_t series)
+    : series(series), counters(series * kSlots) {}
+
+void LatencyRecorder::record(std::size_t index,
+                             std::chrono::nanoseconds duration) {
+  const auto nanos =
+      static_cast<std::uint64_t>(std::max<std::int64_t>(duration.count(), 0));
+  counters.add(index * kSlots + LatencyHistogram::bucketOf(nanos));
+  counters.add(index * kSlots + LatencyHistogram::kBucketCount, nanos);
+}
+
+std::vector<LatencyHistogram> LatencyRecorder::histograms() const {
+  const auto values = counters.sum();
+  std::vector<LatencyHistogram> result(series);
+  for (std::size_t s = 0; s < series; ++s) {
+    auto &histogram = result[s];
+    const auto first = values.begin() + s * kSlots;
+    std::copy(first, first + LatencyHistogram::kBucketCount,
+              histogram.buckets.begin());
+    for (auto bucket : histogram.buckets) {
+      histogram.count += bucket;
+    }
+    histogram.sumNanos = first[LatencyHistogram::kBucketCount];
+  }
+  return result;
+}
+
+// ========== HTTP-ЗАПРОСЫ ==========
+
+RequestMetrics::RequestMetrics(
+    const std::vector<std::pair<std::string, std::string>> &routes)
+    : labels(routes), statuses((routes.size() + 1) * kStatusSlots),
+      latencies(routes.size() + 1) {
+  labels.emplace_back("", "unmatched");
+  for (std::size_t i = 0; i < routes.size(); ++i) {
+    std::string key;
+    appendRouteKey(key, routes[i].first, routes[i].second);
+    seriesByRoute.emplace(std::move(key), i);
+  }
+}
+
+void RequestMetrics::begin() {
+  requestStarted = std::chrono::steady_clock::now();
+  requestBegun = true;
+}
+
+std::size_t RequestMetrics::seriesOf(std::string_view method,
+                                     std::string_view path) const {
+  // Буфер потока: поиск серии обходится без выделения памяти
+  thread_local std::string key;
+  key.clear();
+  appendRouteKey(key, method, path);
+  auto it = seriesByRoute.find(key);
+  return it != seriesByRoute.end() ? it->second : labels.size() - 1;
+}
+
+void RequestMetrics::end(std::string_view method, std::string_view path,
+                         int status) {
+  if (!requestBegun) {
+    return;
+  }
+  requestBegun = false;
+
+  const auto elapsed = std::chrono::steady_clock::now() - requestStarted;
+  const std::size_t series = seriesOf(method, path);
+  const std::size_t statusSlot =
+      status >= kMinStatus && status <= kMaxStatus
+          ? static_cast<std::size_t>(status - kMinStatus) + 1
+          : 0;
+  statuses.add(series * kStatusSlots + statusSlot);
+  latencies.record(series, elapsed);
+}
+
+void RequestMetrics::appendPrometheus(std::string &out) const {
+  const auto counts = statuses.sum();
+  const auto histograms = latencies.histograms();
+
+  std::vector<std::string> routeLabels;
+  routeLabels.reserve(labels.size());
+  for (const auto &[method, route] : labels) {
+    std::string text;
+    appendPrometheusLabel(text, "method", method);
+    appendPrometheusLabel(text, "route", route);
+    routeLabels.push_back(std::move(text));
+  }
+
+  // Серии счётчиков появляются с первым запросом
+  appendPrometheusHeader(out, "rest_server_http_requests_total", "counter",
+                         "HTTP requests by route and status code");
+  for (std::size_t s = 0; s < labels.size(); ++s) {
+    for (std::size_t slot = 0; slot < kStatusSlots; ++slot) {
+      const std::uint64_t value = counts[s * kStatusSlots + slot];
+      if (value == 0) {
+        continue;
+      }
+      std::string text = routeLabels[s];
+      appendPrometheusLabel(
+          text, "status",
+          slot == 0 ? "other"
+                    : std::to_string(kMinStatus + static_cast<int>(slot) - 1));
+      appendPrometheusSample(out, "rest_server_http_requests_total", text,
+                             static_cast<double>(value));
+    }
+  }
+
+  appendPrometheusHeader(out, "rest_server_http_request_duration_seconds",
+                         "histogram",
+                         "Time from parsed request headers to sent response");
+  for (std::size_t s = 0; s < labels.size(); ++s) {
+    if (histograms[s].count > 0) {
+      appendPrometheusHistogram(out,
+                                "rest_server_http_request_duration_seconds",
+                                routeLabels[s], histograms[s]);
+    }
+  }
+
+  appendPrometheusHeader(
+      out, "rest_server_http_request_duration_quantiles_seconds", "summary",
+      "Request duration quantiles with 12.5% relative error");
+  for (std::size_t s = 0; s < labels.size(); ++s) {
+    if (histograms[s].count > 0) {
+      appendPrometheusSummary(
+          out, "rest_server_http_request_duration_quantiles_seconds",
+          routeLabels[s], histograms[s]);
+    }
+  }
+}
+
+// ========== ФОРМАТ PROMETHEUS ==========
+
+void appendPrometheusHeader(std::string &out, std::string_view name,
+                            std::string_view type, std::string_view help) {
+  out += "# HELP ";
+  out.append(name);
+  out += ' ';
+  out.append(help);
+  out += "\n# TYPE ";
+  out.append(name);
+  out += ' ';
+  out.append(type);
+  out += '\n';
+}
+
+void appendPrometheusSample(std::string &out, std::string_view name,
+                            std::string_view labels, double value) {
+  out.append(name);
+  if (!labels.empty()) {
+    out += '{';
+    out.append(labels);
+    out += '}';
+  }
+  out += ' ';
+  appendDouble(out, value);
+  out += '\n';
+}
+
+void appendPrometheusLabel(std::string &labels, std::string_view name,
+                           std::string_view value) {
+  if (!labels.empty()) {
+    labels += ',';
+  }
+  labels.append(name);
+  labels += "=\"";
+  for (char c : value) {
+    switch (c) {
+    case '\\':
+      labels += "\\\\";
+      break;
+    case '"':
+      labels += "\\\"";
+      break;
+    case '\n':
+      labels += "\\n";
+      break;
+    default:
+      labels += c;
+    }
+  }
+  labels += '"';
+}
+
+void appendPrometheusHistogram(std::string &out, std::string_view name,
+                               std::string_view labels,
+                               const LatencyHistogram &histogram) {
+  const std::string bucketName = std::string(name) + "_bucket";
+  // Степени двойки совпадают с границами точных корзин
+  for (unsigned e = kPrometheusFirstExponent; e <= kPrometheusLastExponent;
+       ++e) {
+    const std::uint64_t bound = std::uint64_t{1} << e;
+    std::string text(labels);
+    std::string le;
+    appendDouble(le, toSeconds(bound));
+    appendPrometheusLabel(text, "le", le);
+    appendPrometheusSample(out, bucketName, text,
+                           static_cast<double>(histogram.countBelow(bound)));
+  }
+  std::string text(labels);
+  appendPrometheusLabel(text, "le", "+Inf");
+  appendPrometheusSample(out, bucketName, text,
+                         static_cast<double>(histogram.count));
+
+  appendPrometheusSample(out, std::string(name) + "_sum", labels,
+                         toSeconds(histogram.sumNanos));
+  appendPrometheusSample(out, std::string(name) + "_count", labels,
+                         static_cast<double>(histogram.count));
+}
+
+void appendPrometheusSummary(std::string &out, std::string_view name,
+                             std::string_view labels,
+                             const LatencyHistogram &histogram) {
+  for (double q : kQuantiles) {
+    std::string text(labels);
+    std::string quantile;
+    appendDouble(quantile, q);
+    appendPrometheusLabel(text, "quantile", quantile);
+    appendPrometheusSample(out, name, text,
+                           toSeconds(histogram.quantile(q)));
+  }
+  appendPrometheusSample(out, std::string(name) + "_sum", labels,
+                         toSeconds(histogram.sumNanos));
+  appendPrometheusSample(out, std::string(name) + "_count", labels,
+                         static_cast<double>(histogram.count));
+}
+
+} // namespace Library
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Library {
+
+// Счётчики с записью без блокировок: каждый поток пишет в собственный шард
+// (relaxed-атомики в своих строках кэша), чтение суммирует шарды всех потоков.
+// Шард потока создаётся при его первой записи и живёт вместе с набором, так
+// что значения завершившихся потоков не теряются
+class ShardedCounters {
+public:
+  explicit ShardedCounters(std::size_t size);
+  ~ShardedCounters();
+
+  ShardedCounters(const ShardedCounters &) = delete;
+  ShardedCounters &operator=(const ShardedCounters &) = delete;
+
+  std::size_t size() const { return count; }
+  void add(std::size_t index, std::uint64_t value = 1);
+  // Сумма по всем шардам; значения, записываемые во время чтения, могут
+  // попасть в неё частично
+  std::vector<std::uint64_t> sum() const;
+
+private:
+  struct alignas(64) Line {
+    std::array<std::atomic<std::uint64_t>, 8> values{};
+  };
+  using Shard = std::unique_ptr<Line[]>;
+
+  Line *localShard();
+
+  const std::size_t count;
+  const std::uint64_t id; // Ключ шардов потока, не повторяется
+  mutable std::mutex mtx; // Защищает только список шардов
+  std::vector<Shard> shards;
+};
+
+// Снимок гистограммы задержек в наносекундах. Корзины логарифмически-линейные,
+// как в HdrHistogram: значения до 2^kSubBits хранятся точно, дальше каждый
+// интервал [2^e, 2^(e+1)) делится на 2^kSubBits равных корзин, поэтому
+// относительная погрешность не больше 1/2^kSubBits при любом масштабе
+struct LatencyHistogram {
+  static constexpr unsigned kSubBits = 3;
+  // Всё, что дольше 2^kMaxExponent нс (~18 минут), попадает в последнюю корзину
+  static constexpr unsigned kMaxExponent = 40;
+  static constexpr std::size_t kBucketCount =
+      (kMaxExponent - kSubBits + 1) << kSubBits;
+
+  static std::size_t bucketOf(std::uint64_t nanos);
+  // Нижняя граница корзины; верхняя граница - нижняя граница следующей
+  static std::uint64_t lowerBound(std::size_t bucket);
+
+  std::vector<std::uint64_t> buckets = std::vector<std::uint64_t>(kBucketCount);
+  std::uint64_t count = 0;
+  std::uint64_t sumNanos = 0;
+
+  // Число значений меньше nanos (точно, если nanos - граница корзины)
+  std::uint64_t countBelow(std::uint64_t nanos) const;
+  // Верхняя граница корзины, в которую попадает квантиль q
+  std::uint64_t quantile(double q) const;
+};
+
+// Набор гистограмм задержек series штук поверх ShardedCounters
+class LatencyRecorder {
+public:
+  explicit LatencyRecorder(std::size_t series);
+
+  std::size_t size() const { return series; }
+  void record(std::size_t index, std::chrono::nanoseconds duration);
+  std::vector<LatencyHistogram> histograms() const;
+
+private:
+  // Корзины гистограммы и сумма значений
+  static constexpr std::size_t kSlots = LatencyHistogram::kBucketCount + 1;
+
+  const std::size_t series;
+  ShardedCounters counters;
+};
+
+// Метрики HTTP-запросов: счётчики по маршруту и коду ответа и гистограмма
+// задержек по маршруту. Маршрут - шаблон пути вроде "/books/{id}": числовые
+// сегменты пути заменяются на {id}, так что число серий не зависит от
+// запросов. Пути вне списка маршрутов считаются в общей серии unmatched
+class RequestMetrics {
+public:
+  // routes - пары (метод, шаблон пути)
+  explicit RequestMetrics(
+      const std::vector<std::pair<std::string, std::string>> &routes);
+
+  // Отмечает начало запроса в текущем потоке
+  static void begin();
+  // Учитывает запрос, начатый begin() в этом же потоке. Без begin() (запрос
+  // не дошёл до маршрутизации) ничего не делает
+  void end(std::string_view method, std::string_view path, int status);
+
+  void appendPrometheus(std::string &out) const;
+
+private:
+  // Коды 100-599 и отдельный слот для прочих
+  static constexpr int kMinStatus = 100;
+  static constexpr int kMaxStatus = 599;
+  static constexpr std::size_t kStatusSlots = kMaxStatus - kMinStatus + 2;
+
+  std::size_t seriesOf(std::string_view method, std::string_view path) const;
+
+  // Метки серий; последняя - unmatched
+  std::vector<std::pair<std::string, std::string>> labels;
+  // "МЕТОД шаблон" -> номер серии; после конструктора только читается
+  std::unordered_map<std::string, std::size_t> seriesByRoute;
+  ShardedCounters statuses;
+  LatencyRecorder latencies;
+};
+
+// Текстовый формат Prometheus. labels - уже экранированные пары через
+// запятую без фигурных скобок, например method="GET",route="/books"
+void appendPrometheusHeader(std::string &out, std::string_view name,
+                            std::string_view type, std::string_view help);
+void appendPrometheusSample(std::string &out, std::string_view name,
+                            std::string_view labels, double value);
+void appendPrometheusLabel(std::string &labels, std::string_view name,
+                           std::string_view value);
+// Корзины по степеням двойки от ~1 мкс до ~1 минуты, _sum и _count
+void appendPrometheusHistogram(std::string &out, std::string_view name,
+                               std::string_view labels,
+                               const LatencyHistogram &histogram);
+// Квантили 0.5, 0.9, 0.99 и 0.999 по точным корзинам гистограммы
+void appendPrometheusSummary(std::string &out, std::string_view name,
+                             std::string_view labels,
+                             const LatencyHistogram &histogram);
+
+} // namespace Library
@@ -0,0 +1,43 @@
+#include "response_cache.h"
+
+namespace Library {
+
+ResponseCache::ResponseCache(std::size_t maxEntries, std::size_t maxBodySize)
+    : maxEntries(maxEntries), maxBodySize(maxBodySize) {}
+
+std::shared_ptr<const std::string>
+ResponseCache::get(const std::string &key) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = index.find(key);
+  if (it == index.end()) {
+    return nullptr;
+  }
+
+  entries.splice(entries.begin(), entries, it->second);
+  return it->second->second;
+}
+
+void ResponseCache::put(const std::string &key,
+                        std::shared_ptr<const std::string> body) {
+  if (maxEntries == 0 || !body || body->size() > maxBodySize) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = index.find(key);
+  if (it != index.end()) {
+    it->second->second = std::move(body);
+    entries.splice(entries.begin(), entries, it->second);
+    return;
+  }
+
+  entries.emplace_front(key, std::move(body));
+  index[key] = entries.begin();
+
+  if (entries.size() > maxEntries) {
+    index.erase(entries.back().first);
+    entries.pop_back();
+  }
+}
+
+} // namespace Library
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace Library {
+
+// Небольшой LRU-кэш сериализованных ответов. Ключ включает маршрут, запрос и
+// версию данных, поэтому записи не инвалидируются явно: после изменения базы
+// они перестают запрашиваться и вытесняются более свежими
+class ResponseCache {
+public:
+  explicit ResponseCache(std::size_t maxEntries = 256,
+                         std::size_t maxBodySize = 1 << 20);
+
+  std::shared_ptr<const std::string> get(const std::string &key);
+  void put(const std::string &key, std::shared_ptr<const std::string> body);
+
+private:
+  using Entry = std::pair<std::string, std::shared_ptr<const std::string>>;
+
+  const std::size_t maxEntries;
+  const std::size_t maxBodySize;
+  std::mutex mtx;
+  // Начало списка - самые свежие записи
+  std::list<Entry> entries;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+};
+
+} // namespace Library
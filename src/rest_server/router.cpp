@@ -0,0 +1,137 @@
+#include "router.h"
+
+#include <charconv>
+#include <stdexcept>
+
+namespace Library {
+
+namespace {
+
+// Отделяет первый сегмент пути; path указывает на символ после '/'
+std::string_view nextSegment(std::string_view &path) {
+  const std::size_t slash = path.find('/');
+  std::string_view segment = path.substr(0, slash);
+  path = slash == std::string_view::npos ? std::string_view()
+                                         : path.substr(slash + 1);
+  return segment;
+}
+
+bool isParam(std::string_view segment) {
+  return segment.size() > 2 && segment.front() == '{' &&
+         segment.back() == '}';
+}
+
+} // namespace
+
+bool parseId(std::string_view text, int &id) {
+  int value = 0;
+  auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(),
+                                   value);
+  if (ec != std::errc() || end != text.data() + text.size() || value < 0) {
+    return false;
+  }
+  id = value;
+  return true;
+}
+
+void Router::add(Method method, std::string_view pattern, Handler handler) {
+  if (pattern.empty() || pattern.front() != '/') {
+    throw std::invalid_argument("Route must start with '/'");
+  }
+
+  Node *node = &root;
+  std::string_view rest = pattern.substr(1);
+  std::size_t paramCount = 0;
+  while (!rest.empty()) {
+    const std::string_view segment = nextSegment(rest);
+    if (isParam(segment)) {
+      if (++paramCount > PathParams::kMaxParams) {
+        throw std::invalid_argument("Too many route parameters");
+      }
+      if (!node->param) {
+        node->param = std::make_unique<Node>();
+      }
+      node = node->param.get();
+      continue;
+    }
+
+    Node *child = nullptr;
+    for (auto &[literal, next] : node->literals) {
+      if (literal == segment) {
+        child = next.get();
+        break;
+      }
+    }
+    if (child == nullptr) {
+      node->literals.emplace_back(std::string(segment),
+                                  std::make_unique<Node>());
+      child = node->literals.back().second.get();
+    }
+    node = child;
+  }
+
+  node->handlers[method] = std::move(handler);
+  registered.emplace_back(method == Get ? "GET" : "DELETE", pattern);
+}
+
+const Router::Node *Router::match(const Node *node, std::string_view path,
+                                  PathParams &params) {
+  if (path.empty()) {
+    return node;
+  }
+
+  std::string_view rest = path;
+  const std::string_view segment = nextSegment(rest);
+  // "/books/" не совпадает с "/books": пустой хвост после '/' - тоже сегмент
+  if (rest.empty() && path.size() > segment.size()) {
+    return nullptr;
+  }
+
+  for (const auto &[literal, next] : node->literals) {
+    if (literal == segment) {
+      if (const Node *found = match(next.get(), rest, params)) {
+        return found;
+      }
+      break;
+    }
+  }
+
+  int id = 0;
+  if (node->param && params.count < PathParams::kMaxParams &&
+      parseId(segment, id)) {
+    params.values[params.count++] = id;
+    if (const Node *found = match(node->param.get(), rest, params)) {
+      return found;
+    }
+    --params.count;
+  }
+  return nullptr;
+}
+
+bool Router::dispatch(const httplib::Request &req,
+                      httplib::Response &res) const {
+  Method method;
+  if (req.method == "GET" || req.method == "HEAD") {
+    method = Get;
+  } else if (req.method == "DELETE") {
+    method = Delete;
+  } else {
+    return false;
+  }
+
+  const std::string_view path = req.path;
+  if (path.empty() || path.front() != '/') {
+    return false;
+  }
+
+  PathParams params;
+  const Node *node = match(&root, path.substr(1), params);
+  if (node == nullptr || !node->handlers[method]) {
+    return false;
+  }
+
+  node->handlers[method](req, res, params);
+  return true;
+}
+
+} // namespace Library
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "httplib.h"
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Library {
+
+// Разбирает неотрицательный id из сегмента пути (как прежний шаблон \d+)
+// без исключений и аллокаций
+bool parseId(std::string_view text, int &id);
+
+// Значения параметров {id} из пути запроса в порядке их следования
+class PathParams {
+public:
+  static constexpr std::size_t kMaxParams = 4;
+
+  int operator[](std::size_t index) const { return values[index]; }
+  std::size_t size() const { return count; }
+
+private:
+  friend class Router;
+
+  std::array<int, kMaxParams> values{};
+  std::size_t count = 0;
+};
+
+// Статическая таблица маршрутов без регулярных выражений: сегменты пути
+// ищутся в префиксном дереве, параметры {id} разбираются через from_chars.
+// Обслуживает запросы без тела (GET, HEAD, DELETE) из pre-routing обработчика
+// httplib, до его собственного перебора маршрутов по std::regex
+class Router {
+public:
+  using Handler = std::function<void(const httplib::Request &,
+                                     httplib::Response &, const PathParams &)>;
+
+  // pattern - путь из литеральных сегментов и параметров {name},
+  // например "/books/{id}". Литеральный сегмент важнее параметра
+  template <typename Fn> void get(std::string_view pattern, Fn &&fn) {
+    add(Method::Get, pattern, wrap(std::forward<Fn>(fn)));
+  }
+  template <typename Fn> void del(std::string_view pattern, Fn &&fn) {
+    add(Method::Delete, pattern, wrap(std::forward<Fn>(fn)));
+  }
+
+  // Вызывает обработчик маршрута; false, если маршрута нет
+  bool dispatch(const httplib::Request &req, httplib::Response &res) const;
+
+  // Зарегистрированные маршруты: пары (метод, шаблон) в порядке добавления
+  const std::vector<std::pair<std::string, std::string>> &routes() const {
+    return registered;
+  }
+
+private:
+  enum Method { Get, Delete, MethodCount };
+
+  struct Node {
+    std::vector<std::pair<std::string, std::unique_ptr<Node>>> literals;
+    std::unique_ptr<Node> param;
+    std::array<Handler, MethodCount> handlers;
+  };
+
+  template <typename Fn> static Handler wrap(Fn &&fn) {
+    if constexpr (std::is_invocable_v<Fn &, const httplib::Request &,
+                                      httplib::Response &,
+                                      const PathParams &>) {
+      return Handler(std::forward<Fn>(fn));
+    } else {
+      return [fn = std::forward<Fn>(fn)](const httplib::Request &req,
+                                         httplib::Response &res,
+                                         const PathParams &) { fn(req, res); };
+    }
+  }
+
+  void add(Method method, std::string_view pattern, Handler handler);
+  static const Node *match(const Node *node, std::string_view path,
+                           PathParams &params);
+
+  Node root;
+  std::vector<std::pair<std::string, std::string>> registered;
+};
+
+} // namespace Library
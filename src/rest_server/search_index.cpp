@@ -0,0 +1,148 @@
+#include "search_index.h"
+
+#include <algorithm>
+
+namespace Library {
+
+namespace {
+
+// Декодирует один символ UTF-8; для некорректной последовательности
+// возвращает U+FFFD и пропускает один байт
+char32_t decodeUtf8(std::string_view text, std::size_t &pos) {
+  const auto byte = [&](std::size_t i) {
+    return static_cast<unsigned char>(text[i]);
+  };
+
+  const unsigned char lead = byte(pos);
+  std::size_t length = lead < 0x80           ? 1
+                       : (lead >> 5) == 0x06 ? 2
+                       : (lead >> 4) == 0x0E ? 3
+                       : (lead >> 3) == 0x1E ? 4
+                                             : 0;
+  if (length == 0 || pos + length > text.size()) {
+    ++pos;
+    return U'�';
+  }
+
+  char32_t cp = length == 1 ? lead : lead & (0xFF >> (length + 1));
+  for (std::size_t i = 1; i < length; ++i) {
+    if ((byte(pos + i) & 0xC0) != 0x80) {
+      ++pos;
+      return U'�';
+    }
+    cp = (cp << 6) | (byte(pos + i) & 0x3F);
+  }
+  pos += length;
+  return cp;
+}
+
+void appendUtf8(std::string &out, char32_t cp) {
+  if (cp < 0x80) {
+    out.push_back(static_cast<char>(cp));
+  } else if (cp < 0x800) {
+    out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  } else if (cp < 0x10000) {
+    out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  } else {
+    out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+}
+
+char32_t foldCase(char32_t cp) {
+  if (cp >= U'A' && cp <= U'Z') {
+    return cp + 0x20;
+  }
+  if (cp >= U'А' && cp <= U'Я') {
+    return cp + 0x20;
+  }
+  if (cp == U'Ё' || cp == U'ё') {
+    return U'е';
+  }
+  if (cp >= 0x0400 && cp <= 0x040F) { // Ѐ..Џ
+    return cp + 0x50;
+  }
+  return cp;
+}
+
+bool isWordChar(char32_t cp) {
+  if (cp < 0x80) {
+    return (cp >= U'0' && cp <= U'9') || (cp >= U'a' && cp <= U'z') ||
+           (cp >= U'A' && cp <= U'Z');
+  }
+  // Пунктуация Latin-1, общая пунктуация и символ замены не входят в слова
+  if ((cp >= 0x00A0 && cp <= 0x00BF) || cp == 0x00D7 || cp == 0x00F7) {
+    return false;
+  }
+  if ((cp >= 0x2000 && cp <= 0x206F) || cp == U'�') {
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+std::vector<std::string> tokenize(std::string_view text) {
+  std::vector<std::string> tokens;
+  std::string current;
+
+  std::size_t pos = 0;
+  while (pos < text.size()) {
+    const char32_t cp = decodeUtf8(text, pos);
+    if (isWordChar(cp)) {
+      appendUtf8(current, foldCase(cp));
+    } else if (!current.empty()) {
+      tokens.push_back(std::move(current));
+      current.clear();
+    }
+  }
+  if (!current.empty()) {
+    tokens.push_back(std::move(current));
+  }
+
+  // Повторяющиеся слова индексируем один раз
+  std::sort(tokens.begin(), tokens.end());
+  tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+  return tokens;
+}
+
+void InvertedIndex::add(int id, std::string_view text) {
+  for (auto &token : tokenize(text)) {
+    auto &ids = postings[std::move(token)];
+    // Новые документы получают максимальный id, поэтому обычно это push_back
+    if (ids.empty() || ids.back() < id) {
+      ids.push_back(id);
+      continue;
+    }
+
+    auto pos = std::lower_bound(ids.begin(), ids.end(), id);
+    if (pos == ids.end() || *pos != id) {
+      ids.insert(pos, id);
+    }
+  }
+}
+
+void InvertedIndex::remove(int id, std::string_view text) {
+  for (const auto &token : tokenize(text)) {
+    auto it = postings.find(token);
+    if (it == postings.end()) {
+      continue;
+    }
+
+    auto &ids = it->second;
+    auto pos = std::lower_bound(ids.begin(), ids.end(), id);
+    if (pos != ids.end() && *pos == id) {
+      ids.erase(pos);
+    }
+    if (ids.empty()) {
+      postings.erase(it);
+    }
+  }
+}
+
+} // namespace Library
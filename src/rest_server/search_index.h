@@ -0,0 +1,39 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Library {
+
+// Разбивает UTF-8 текст на слова в нижнем регистре. Понимает латиницу и
+// кириллицу (ё приводится к е), остальные символы вне ASCII считаются буквами
+std::vector<std::string> tokenize(std::string_view text);
+
+// Инвертированный индекс: слово -> упорядоченные id документов.
+// Слова хранятся в упорядоченном map, поэтому все слова с заданным префиксом
+// лежат подряд и находятся через lower_bound
+class InvertedIndex {
+public:
+  void add(int id, std::string_view text);
+  void remove(int id, std::string_view text);
+
+  // Вызывает fn(id, exact) для каждого документа, в котором есть слово,
+  // начинающееся с prefix; exact - слово совпало целиком
+  template <typename Fn>
+  void forEachPrefixMatch(const std::string &prefix, Fn &&fn) const {
+    for (auto it = postings.lower_bound(prefix);
+         it != postings.end() && it->first.starts_with(prefix); ++it) {
+      const bool exact = it->first.size() == prefix.size();
+      for (int id : it->second) {
+        fn(id, exact);
+      }
+    }
+  }
+
+private:
+  std::map<std::string, std::vector<int>, std::less<>> postings;
+};
+
+} // namespace Library
@@ -0,0 +1,130 @@
+#include "worker_pool.h"
+
+#include <algorithm>
+
+namespace Library {
+
+namespace {
+
+// Соединения, ожидающие ответа 503. Сверх этого соединение закрывается сразу
+constexpr std::size_t kMaxShedQueue = 128;
+
+thread_local bool shedding = false;
+
+} // namespace
+
+WorkerPool::WorkerPool(std::size_t threadCount, std::size_t maxQueue,
+                       WorkerPoolMetrics &metrics)
+    : maxQueue(maxQueue), metrics(metrics) {
+  if (threadCount == 0) {
+    threadCount = std::max(8u, std::thread::hardware_concurrency());
+  }
+  metrics.threads = threadCount;
+  metrics.maxQueue = maxQueue;
+
+  workers.reserve(threadCount);
+  for (std::size_t i = 0; i < threadCount; ++i) {
+    workers.emplace_back([this] { work(); });
+  }
+  shedder = std::thread([this] { shed(); });
+}
+
+WorkerPool::~WorkerPool() { shutdown(); }
+
+bool WorkerPool::enqueue(std::function<void()> fn) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (stopping) {
+      return false;
+    }
+
+    if (tasks.size() < maxQueue) {
+      tasks.push_back({std::move(fn), std::chrono::steady_clock::now()});
+      metrics.queueDepth = tasks.size();
+      ++metrics.accepted;
+      workReady.notify_one();
+      return true;
+    }
+
+    if (shedTasks.size() < kMaxShedQueue) {
+      shedTasks.push_back(std::move(fn));
+      ++metrics.shed;
+      shedReady.notify_one();
+      return true;
+    }
+  }
+
+  // httplib сам закроет сокет
+  ++metrics.dropped;
+  return false;
+}
+
+void WorkerPool::shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (stopping) {
+      return;
+    }
+    stopping = true;
+  }
+  workReady.notify_all();
+  shedReady.notify_all();
+
+  // Принятые соединения дообрабатываются до конца
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  shedder.join();
+}
+
+bool WorkerPool::isShedding() { return shedding; }
+
+void WorkerPool::work() {
+  for (;;) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      workReady.wait(lock, [&] { return stopping || !tasks.empty(); });
+      if (tasks.empty()) {
+        return;
+      }
+      task = std::move(tasks.front());
+      tasks.pop_front();
+      metrics.queueDepth = tasks.size();
+    }
+
+    const auto waitMicros = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - task.queuedAt)
+            .count());
+    ++metrics.started;
+    metrics.waitMicrosTotal += waitMicros;
+    std::uint64_t maxWait = metrics.waitMicrosMax.load();
+    while (maxWait < waitMicros &&
+           !metrics.waitMicrosMax.compare_exchange_weak(maxWait, waitMicros)) {
+    }
+
+    ++metrics.busy;
+    task.fn();
+    --metrics.busy;
+  }
+}
+
+void WorkerPool::shed() {
+  shedding = true;
+  for (;;) {
+    std::function<void()> fn;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      shedReady.wait(lock, [&] { return stopping || !shedTasks.empty(); });
+      if (shedTasks.empty()) {
+        return;
+      }
+      fn = std::move(shedTasks.front());
+      shedTasks.pop_front();
+    }
+    fn();
+  }
+}
+
+} // namespace Library
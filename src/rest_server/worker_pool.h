@@ -0,0 +1,76 @@
+#pragma once
+
+#include "httplib.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Library {
+
+// Счётчики пула обработчиков. Живут дольше самого пула: httplib создаёт и
+// удаляет очередь задач внутри listen()
+struct WorkerPoolMetrics {
+  std::atomic<std::size_t> threads{0};
+  std::atomic<std::size_t> maxQueue{0};
+  std::atomic<std::size_t> queueDepth{0}; // Соединения, ждущие обработчика
+  std::atomic<std::size_t> busy{0};       // Занятые обработчики
+  std::atomic<std::uint64_t> accepted{0}; // Принятые в очередь соединения
+  std::atomic<std::uint64_t> started{0};  // Дождавшиеся обработчика
+  std::atomic<std::uint64_t> shed{0};     // Отклонённые с 503
+  std::atomic<std::uint64_t> dropped{0};  // Закрытые без ответа
+  // Время ожидания в очереди: сумма и максимум, в микросекундах
+  std::atomic<std::uint64_t> waitMicrosTotal{0};
+  std::atomic<std::uint64_t> waitMicrosMax{0};
+};
+
+// Очередь задач httplib с фиксированным числом обработчиков и ограниченной
+// очередью. Когда очередь заполнена, соединение не ждёт, а сразу уходит
+// отдельному потоку сброса нагрузки: там isShedding() возвращает true и
+// pre-routing обработчик отвечает 503 с Retry-After. Так задержка принятых
+// запросов ограничена длиной очереди, а остальные клиенты быстро узнают о
+// перегрузке вместо таймаута
+class WorkerPool final : public httplib::TaskQueue {
+public:
+  // threadCount = 0 - по числу ядер, но не меньше 8 (как в httplib)
+  WorkerPool(std::size_t threadCount, std::size_t maxQueue,
+             WorkerPoolMetrics &metrics);
+  ~WorkerPool() override;
+
+  bool enqueue(std::function<void()> fn) override;
+  void shutdown() override;
+
+  // true в потоке, который обрабатывает соединение сверх очереди
+  static bool isShedding();
+
+private:
+  struct Task {
+    std::function<void()> fn;
+    std::chrono::steady_clock::time_point queuedAt;
+  };
+
+  void work();
+  void shed();
+
+  const std::size_t maxQueue;
+  WorkerPoolMetrics &metrics;
+
+  std::mutex mtx;
+  std::condition_variable workReady;
+  std::condition_variable shedReady;
+  std::deque<Task> tasks;
+  std::deque<std::function<void()>> shedTasks;
+  bool stopping = false;
+
+  std::vector<std::thread> workers;
+  std::thread shedder;
+};
+
+} // namespace Library